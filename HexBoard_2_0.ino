@@ -14,11 +14,18 @@ using namespace hexBoardHW;
 #include "src/hexBoardGrid.h"
 Button_Grid hexBoard(hexBoard_layout_hw_1_2);
 
-#include "src/layout.h"
-App_Data music[buttons_count];
-
 #include "src/LED.h"
-Pixel_Data pixel[buttons_count];
+LED_Compositor LEDs;
+
+#include "src/palette.h"
+Palette_Rings palette;
+
+#include "src/animation.h"
+Animation_Engine animation(hexBoard);
+
+#include "src/layout.h"
+Note_Table music;
+Layout_Engine layout(hexBoard, music, palette, animation);
 
 
 #include "src/OLED.h"
@@ -29,6 +36,64 @@ wave_tbl cached_waveform;
 
 #include "src/MIDI_api.h"
 
+#include "src/MTS.h"
+MTS_Tuning MTS;
+MTS_Received MTS_in;
+#include "src/MIDI_input.h"
+Pitch_Index    pitch_index;
+External_Notes external_notes;
+
+#include "src/tempo.h"
+#include "hardware/irq.h"
+Tempo_Engine tempo;
+
+#include "src/dashboard.h"
+Dashboard dashboard;
+
+#include "src/wheel.h"
+Wheel_Engine wheels;
+
+// as clock master, the clock ticks on an alarm pool of its
+// own, at a higher interrupt priority than the LED and OLED
+// timers, so a long OLED frame can't hold up a clock. the
+// clock bytes themselves go out from loop(), first in line,
+// as the MIDI ports can't be written from an interrupt.
+const uint     clock_hardware_alarm = 2;  // the default pool uses 3
+alarm_pool_t*  clock_alarm_pool = nullptr;
+struct repeating_timer polling_timer_clock;
+bool           clock_timer_running = false;
+
+bool on_MIDI_clock_tick(repeating_timer *t) {
+  // negative: from the start of this tick to the next
+  t->delay_us = -(int64_t)tempo.master_tick(timer_hw->timerawl);
+  return true;
+}
+
+void set_clock_mode(int m) {
+  if (clock_timer_running) {
+    cancel_repeating_timer(&polling_timer_clock);
+    clock_timer_running = false;
+    MIDI_api.sendRealTime(midi::Stop);
+  }
+  tempo.reset(m == _clockMode_master, timer_hw->timerawl);
+  if (m != _clockMode_master) return;
+  if (clock_alarm_pool == nullptr) {
+    clock_alarm_pool = alarm_pool_create(clock_hardware_alarm, 1);
+    irq_set_priority(TIMER_IRQ_0 + clock_hardware_alarm, PICO_HIGHEST_IRQ_PRIORITY);
+  }
+  MIDI_api.sendRealTime(midi::Start);
+  clock_timer_running = alarm_pool_add_repeating_timer_us(clock_alarm_pool,
+    -(int64_t)(tempo_period_q8(settings[_tempoBPM].i) >> 8),
+    on_MIDI_clock_tick, NULL, &polling_timer_clock);
+}
+
+// clocks ticked since the last pass
+void send_MIDI_clocks() {
+  for (uint32_t n = tempo.take_clocks_due(); n > 0; --n) {
+    MIDI_api.sendRealTime(midi::Clock);
+  }
+}
+
 #include "src/menu.h"
 
 
@@ -51,69 +116,274 @@ void apply_settings_to_objects() {
   on_setting_change(_synthBuz);
   on_setting_change(_rotInv);
   on_setting_change(_synthWav);
-  //generate_layout(refS);
+  on_setting_change(_palette);
+  on_setting_change(_hueLoop);
+  palette.build_all(settings);
+  layout.request(_relayout_axes);
+  layout.update(settings);
+  on_setting_change(_MPEzoneC);
+  on_setting_change(_MIDImode);
+  on_setting_change(_tempoBPM);
+  on_setting_change(_clockMode);
+  on_setting_change(_tglWheel);
 }
 
-void note_on(Physical_Button& b) {
-  App_Data *n = static_cast<App_Data*>(b.app_data_ptr);
-  if (n == nullptr) return;  
-  // synth note-on
+// global pitch bend on the synth, as a fixed-point ratio.
+// the pitch wheel and bend coming in over MIDI are kept
+// apart, so moving one doesn't undo the other.
+uint32_t synth_bend_ratio = no_pitch_bend;
+int16_t  MIDI_input_bend  = 0;
+
+// in tuning table mode, give each pitch its own MIDI note
+// and tell the synth about any tunings that changed.
+void send_tuning_table() {
+  if (settings[_MIDImode].i != _MIDImode_tuning_table) return;
+  MTS.assign(music.note, music.table);
+  size_t length;
+  const uint8_t* msg = MTS.message(length);
+  if (msg != nullptr) {
+    MIDI_api.sendSysEx(msg, length);
+  }
+}
+
+// the linear waveforms morph with the mod wheel (the
+// pulse width, or the slope); hybrid always has its own
+// table per pitch. the rest play the cached table.
+void update_synth_waveform(Synth::Voice& v, double freq) {
+  uint8_t mod = wheels.wheel[_wheel_mod].value;
+  switch (settings[_synthWav].i) {
+    case _synthWav_hybrid:
+      v.update_wavetable(linear_waveform(freq, Linear_Wave::hybrid, mod));
+      break;
+    case _synthWav_square:
+      if (mod) v.update_wavetable(linear_waveform(freq, Linear_Wave::square, mod));
+      else     v.update_wavetable(cached_waveform);
+      break;
+    case _synthWav_saw:
+      if (mod) v.update_wavetable(linear_waveform(freq, Linear_Wave::saw, mod));
+      else     v.update_wavetable(cached_waveform);
+      break;
+    case _synthWav_triangle:
+      if (mod) v.update_wavetable(linear_waveform(freq, Linear_Wave::triangle, mod));
+      else     v.update_wavetable(cached_waveform);
+      break;
+    default:
+      v.update_wavetable(cached_waveform);
+      break;
+  }
+}
+
+// start a synth voice, if one is free. returns its
+// number (1 - synth_polyphony_limit), or 0 if none.
+uint8_t synth_voice_on(uint32_t interval, double freq, uint8_t velocity, uint8_t gain) {
   using namespace Synth;
-  if (!queue_is_empty(&open_channel_queue)) {  
-    queue_remove_blocking(&open_channel_queue, &(n->synthChPlaying) );
-    Voice *v = &voice[(n->synthChPlaying) - 1];
-    double adj_f = frequency_after_pitch_bend(n->freq, 0 /*global pb*/, 2 /*pb range*/);
-    v->update_pitch(frequency_to_interval(adj_f, audio_sample_interval_uS));
-    if    ((settings[_synthWav].i == _synthWav_hybrid) || ( false /*mod wheel > 0*/
-      &&  ((settings[_synthWav].i == _synthWav_square) 
-        || (settings[_synthWav].i == _synthWav_saw)
-        || (settings[_synthWav].i == _synthWav_triangle)
-    ))) {
-      v->update_wavetable(linear_waveform(adj_f, Linear_Wave::hybrid, 0 /*mod wheel value*/));
-    } else {
-      v->update_wavetable(cached_waveform);
-    }
-    v->update_base_volume((settings[_synthVol].i * b.velocity * iso226(adj_f)) >> 15);
-    switch (settings[_synthEnv].i) { // attack ms, decay ms, sustain 0-255, release ms
-      case _synthEnv_hit:     v->update_envelope(  20,   50, 128,  100); break;
-      case _synthEnv_pluck:   v->update_envelope(  20, 1000,  24,  100); break;
-      case _synthEnv_strum:   v->update_envelope(  50, 2000, 128,  500); break;
-      case _synthEnv_slow:    v->update_envelope(1000,    0, 255, 1000); break;
-      case _synthEnv_reverse: v->update_envelope(2000,    0,   0,    0); break;      
-      default:                v->update_envelope(   0,    0, 255,    0); break;
-    }
-    v->note_on();
+  if (queue_is_empty(&open_channel_queue)) return 0;
+  uint8_t n;
+  queue_remove_blocking(&open_channel_queue, &n);
+  Voice *v = &voice[n - 1];
+  v->update_pitch(interval_after_pitch_bend(interval, synth_bend_ratio));
+  update_synth_waveform(*v, freq);
+  v->update_base_volume((settings[_synthVol].i * velocity * gain) >> 15);
+  switch (settings[_synthEnv].i) { // attack ms, decay ms, sustain 0-255, release ms
+    case _synthEnv_hit:     v->update_envelope(  20,   50, 128,  100); break;
+    case _synthEnv_pluck:   v->update_envelope(  20, 1000,  24,  100); break;
+    case _synthEnv_strum:   v->update_envelope(  50, 2000, 128,  500); break;
+    case _synthEnv_slow:    v->update_envelope(1000,    0, 255, 1000); break;
+    case _synthEnv_reverse: v->update_envelope(2000,    0,   0,    0); break;      
+    default:                v->update_envelope(   0,    0, 255,    0); break;
+  }
+  v->note_on();
+  return n;
+}
+
+void synth_voice_off(uint8_t n) {
+  if (!n) return;
+  using namespace Synth;
+  voice[n - 1].note_off();
+  if (!queue_is_full(&open_channel_queue)) {
+    queue_add_blocking(&open_channel_queue, &n);
   }
+}
+
+// the velocity wheel scales how hard a key was struck;
+// at its rest position of 96 it leaves it as is.
+uint8_t wheel_velocity(uint8_t velocity) {
+  uint32_t v = (uint32_t)velocity * wheels.wheel[_wheel_velocity].value / 96;
+  return (v < 1 ? 1 : (v > 127 ? 127 : v));
+}
+
+// per-note timbre (MPE and MIDI 2.0) follows the mod
+// wheel, from the center at rest to the top.
+uint8_t wheel_timbre() {
+  return 0x40 + (wheels.wheel[_wheel_mod].value >> 1);
+}
+
+void note_on(uint8_t i) {
+  uint8_t velocity = wheel_velocity(hexBoard.velocity[i]);
+  // synth note-on
+  music.synthChPlaying[i] = synth_voice_on(music.interval[i], music.freq[i], velocity, music.gain[i]);
 
   // MIDI note-on
-  MIDI_api.noteOn(n->channel,n->table,n->note,b.velocity);
+  music.midiNotePlaying[i] = music.table[i];
+  music.pitchPlaying[i] = music.pitch_7_9[i];
+  music.midiChPlaying[i] = MIDI_api.noteOn(i,music.channel[i],music.table[i],music.bend[i],music.pitch_7_9[i],velocity,wheel_timbre());
 }
 
-void note_off(Physical_Button& b) {
-  App_Data *n = static_cast<App_Data*>(b.app_data_ptr);
-  if (n == nullptr) return;  
+void note_off(uint8_t i) {
   // synth note-off
-  if (n->synthChPlaying) {
-    using namespace Synth;
-    voice[(n->synthChPlaying) - 1].note_off();
-    if (!queue_is_full(&open_channel_queue)) {
-      queue_add_blocking(
-        &open_channel_queue, 
-        &(n->synthChPlaying)
-      );
-    }
-    n->synthChPlaying = 0;
-  }
+  synth_voice_off(music.synthChPlaying[i]);
+  music.synthChPlaying[i] = 0;
   
   // MIDI note-off
-  MIDI_api.noteOff(n->midiChPlaying,n->table,n->note,0);
+  MIDI_api.noteOff(i,music.midiChPlaying[i],music.midiNotePlaying[i],0);
+  music.midiChPlaying[i] = 0;
+}
+
+/*
+ * MIDI input
+ */
+
+// the synth plays incoming notes at the pitch of the
+// last tuning dump received (12EDO until then)
+double external_frequency(uint8_t note) {
+  return 440.0 * exp2((MTS_in.pitch(note) - 69.0) / 12.0);
+}
+
+// after the global bend or an incoming tuning changes
+void retune_synth_voices() {
+  using namespace Synth;
+  for (size_t i = 0; i < buttons_count; ++i) {
+    if (!music.synthChPlaying[i]) continue;
+    voice[music.synthChPlaying[i] - 1].update_pitch(
+      interval_after_pitch_bend(music.interval[i], synth_bend_ratio));
+  }
+  for (auto& n : external_notes.slot) {
+    if (!n.active || !n.voice) continue;
+    uint32_t interval = frequency_to_interval(external_frequency(n.note), audio_sample_interval_uS);
+    voice[n.voice - 1].update_pitch(interval_after_pitch_bend(interval, synth_bend_ratio));
+  }
+}
+
+// after either bend, or the bend range, changes
+void update_synth_bend() {
+  uint8_t range = settings[_pbRange].i;
+  synth_bend_ratio = ((uint64_t)pitch_bend_ratio(wheels.wheel[_wheel_bend].value, range)
+                      * pitch_bend_ratio(MIDI_input_bend, range)) >> pitch_bend_ratio_bits;
+  retune_synth_voices();
+}
+
+// after the mod wheel moves
+void remorph_synth_voices() {
+  using namespace Synth;
+  for (size_t i = 0; i < buttons_count; ++i) {
+    if (!music.synthChPlaying[i]) continue;
+    update_synth_waveform(voice[music.synthChPlaying[i] - 1], music.freq[i]);
+  }
+  for (auto& n : external_notes.slot) {
+    if (!n.active || !n.voice) continue;
+    update_synth_waveform(voice[n.voice - 1], external_frequency(n.note));
+  }
+}
+
+// a held note keeps its note number until it is let go,
+// so a transpose or retune while it sounds is a per-note
+// bend (MPE, MIDI 2.0) and a new synth pitch.
+void retune_held_notes() {
+  for (size_t i = 0; i < buttons_count; ++i) {
+    if (!music.midiChPlaying[i]) continue;
+    MIDI_api.noteRetune(i, music.midiChPlaying[i], music.midiNotePlaying[i], music.pitchPlaying[i], music.note[i]);
+  }
+  retune_synth_voices();
+}
+
+// each button's MIDI note is final once the tuning table
+// is out, so the reverse index for MIDI input can follow.
+void after_relayout() {
+  send_tuning_table();
+  pitch_index.build(music.table);
+  retune_held_notes();
+}
+
+void light_external_note(uint8_t note, bool on) {
+  for (uint8_t b = pitch_index.first[note]; b != no_button; b = pitch_index.next[b]) {
+    // a key the player is holding stays lit
+    if (on || (hexBoard.velocity[b] == 0)) LEDs.set_held(b, on);
+  }
+}
+
+void external_note_off(uint8_t channel, uint8_t note) {
+  External_Note* n = external_notes.find(channel, note);
+  if (n == nullptr) return;
+  synth_voice_off(n->voice);
+  n->active = false;
+  light_external_note(note, false);
+}
+
+void external_note_on(uint8_t channel, uint8_t note, uint8_t velocity) {
+  external_note_off(channel, note);  // a repeated note restarts
+  External_Note* n = external_notes.open();
+  if (n == nullptr) return;
+  double freq = external_frequency(note);
+  n->active  = true;
+  n->channel = channel;
+  n->note    = note;
+  n->voice   = synth_voice_on(frequency_to_interval(freq, audio_sample_interval_uS),
+                              freq, velocity, iso226(freq));
+  light_external_note(note, true);
+}
+
+template <class Port>
+void read_MIDI_port(Port& port, uint32_t start_uS) {
+  while ((timer_hw->timerawl - start_uS < MIDI_input_budget_uS) && port.read()) {
+    switch (port.getType()) {
+      case midi::NoteOn:
+        if (port.getData2()) {
+          external_note_on(port.getChannel(), port.getData1(), port.getData2());
+          break;
+        }
+        // a note-on with velocity 0 is a note-off: fall through
+      case midi::NoteOff:
+        external_note_off(port.getChannel(), port.getData1());
+        break;
+      case midi::PitchBend: {
+        MIDI_input_bend = ((port.getData2() << 7) | port.getData1()) - 8192;
+        update_synth_bend();
+        break;
+      }
+      case midi::Clock:
+        if (settings[_clockMode].i == _clockMode_slave) tempo.on_clock(timer_hw->timerawl);
+        break;
+      case midi::Start:
+        if (settings[_clockMode].i == _clockMode_slave) tempo.on_start(timer_hw->timerawl);
+        break;
+      case midi::Continue:
+        if (settings[_clockMode].i == _clockMode_slave) tempo.on_continue(timer_hw->timerawl);
+        break;
+      case midi::Stop:
+        if (settings[_clockMode].i == _clockMode_slave) tempo.on_stop(timer_hw->timerawl);
+        break;
+      case midi::SystemExclusive:
+        if (MTS_in.receive(port.getSysExArray(), port.getSysExArrayLength())) {
+          retune_synth_voices();
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// both ports share the time budget
+void read_MIDI_input() {
+  uint32_t start_uS = timer_hw->timerawl;
+  if (settings[_MIDIusb].b)  read_MIDI_port(UMIDI, start_uS);
+  if (settings[_MIDIjack].b) read_MIDI_port(SMIDI, start_uS);
 }
 
 void color_this_hex(const Hex& h, const HSV& c) {
-  strip.setPixelColor(
-    hexBoard.btn_by_coord.at(h)->pixel, 
-    okhsv_to_neopixel_code(c)
-  );
+  uint8_t i = hexBoard.index_at(h);
+  if (i == no_button) return;
+  LEDs.set_layer(_LED_layer_base, i, okhsv_to_neopixel_code(c));
 }
 
 /*
@@ -125,21 +395,23 @@ volatile uint32_t GUI_timestampCW = -GUI_arrowPersist_uS;
 volatile uint32_t GUI_timestampCCW = -GUI_arrowPersist_uS;
 volatile uint8_t GUI_iconKnobClick = 0;
 
-void draw_input_monitor(std::string s) {
+void draw_input_monitor(std::string_view s) {
   // draw GUI element that shows reactive 
   // pixel grid representing buttons currently
   // pressed. the string passed thru is ignored
   int atX;
   int atY;
-  for (auto& b : hexBoard.btn) {
-    atX = 108 + 2 * b.coord.x - (b.coord.x <= -10 ? 1 : 0);
-    atY = 106 + 3 * b.coord.y;
+  for (size_t i = 0; i < buttons_count; ++i) {
+    const Hex& h = hexBoard.coord[i];
+    uint8_t p = hexBoard.pressure[i];
+    atX = 108 + 2 * h.x - (h.x <= -10 ? 1 : 0);
+    atY = 106 + 3 * h.y;
                             u8g2.drawPixel(atX,atY);
-    if (b.pressure) {       u8g2.drawPixel(atX  ,atY-1);   // off low mid hi
+    if (p) {                u8g2.drawPixel(atX  ,atY-1);   // off low mid hi
                             u8g2.drawPixel(atX  ,atY+1);   //      *   *  ***
-    if (b.pressure >  64) { u8g2.drawPixel(atX-1,atY  );   //  *   *  *** ***
+    if (p >  64) {          u8g2.drawPixel(atX-1,atY  );   //  *   *  *** ***
                             u8g2.drawPixel(atX+1,atY  ); } //      *   *  ***
-    if (b.pressure >  96) { u8g2.drawPixel(atX-1,atY-1);   //
+    if (p >  96) {          u8g2.drawPixel(atX-1,atY-1);   //
                             u8g2.drawPixel(atX-1,atY+1);   //
                             u8g2.drawPixel(atX+1,atY-1);   //
                             u8g2.drawPixel(atX+1,atY+1); } //          
@@ -177,22 +449,49 @@ void draw_input_monitor(std::string s) {
   }
 }
 
-void draw_GUI_sliders(std::string s) {
+int32_t get_live_value(uint8_t p) {
+  switch (p) {
+    case _live_transpose:  return settings[_txposeS].i;
+    case _live_program:    return settings[_MIDIpc].i;
+    case _live_brightness: return settings[_globlBrt].i;
+    case _live_volume:     return settings[_synthVol].i;
+    case _live_mod:        return wheels.wheel[_wheel_mod].value;
+    case _live_bend:       return wheels.wheel[_wheel_bend].value;
+    default:               return 0;
+  }
 }
 
-void draw_GUI_dashboard(std::string s) {
-  // GUI element in "play" mode
-  // show live rotary control information
-  // knob press toggles what the rotary controls
-  // e.g. transpose, program change, animations, etc.
+void draw_GUI_sliders(std::string_view s) {
+  // one bar per live parameter, the selected one filled
+  u8g2.setFont(u8g2_font_4x6_tr);
+  for (size_t k = 0; k < live_parameter_slots; ++k) {
+    uint8_t p = live_parameter_order[k];
+    uint8_t y = slider_top + k * slider_pitch;
+    uint8_t length = Dashboard::bar_length(p, get_live_value(p));
+    u8g2.drawStr(_LEFT_MARGIN, y + slider_height, live_parameters[p].label);
+    if (p == dashboard.selected()) {
+      u8g2.drawBox(slider_left, y, length, slider_height);
+    } else {
+      u8g2.drawHLine(slider_left, y + slider_height / 2, length);
+    }
+    u8g2.drawVLine(slider_left + slider_width, y, slider_height);
+  }
+  u8g2.setFont(u8g2_font_6x12_tr);
 }
 
-void draw_GUI_popup(std::string s) {
+void draw_GUI_dashboard(std::string_view s) {
+  // GUI element in "play" mode: what the knob
+  // controls right now, and its value
   u8g2.setFont(u8g2_font_6x12_tr);
   drawStringWrap(_LEFT_MARGIN, 12, s, false);
 }
 
-void draw_GUI_verbose_log(std::string s) {
+void draw_GUI_popup(std::string_view s) {
+  u8g2.setFont(u8g2_font_6x12_tr);
+  drawStringWrap(_LEFT_MARGIN, 12, s, false);
+}
+
+void draw_GUI_verbose_log(std::string_view s) {
   // draw verbose text currently stored in
   // GUI instance
   u8g2.setFont(u8g2_font_4x6_tr);
@@ -200,7 +499,7 @@ void draw_GUI_verbose_log(std::string s) {
   u8g2.setFont(u8g2_font_6x12_tr);
 }
 
-void draw_GUI_footer(std::string s) {
+void draw_GUI_footer(std::string_view s) {
   // display the "HUD footer" text assigned to the menu page you're on
   u8g2.setFont(u8g2_font_4x6_tr);
   drawStringWrap(_LEFT_MARGIN, 122, s, true);
@@ -230,31 +529,48 @@ void initialize_GUI_layers() {
  *  Handlers for UI input: key and knob
  */
 
-void key_handler_playback(Physical_Button& b) {
-  if (b.check_and_reset_just_pressed()) {
-    note_on(b);
-  } else if (b.check_and_reset_just_released()) {
-    note_off(b);
-  } else if (b.pressure) {
-    // nothing
+void key_handler_playback(uint8_t i) {
+  if (hexBoard.check_and_reset_just_pressed(i)) {
+    LEDs.set_held(i, true);
+    animation.start(i, settings[_animType].i, hexBoard.timeLastUpdate[i]);
+    note_on(i);
+  } else if (hexBoard.check_and_reset_just_released(i)) {
+    LEDs.set_held(i, false);
+    animation.release(i);
+    note_off(i);
+  } else if (hexBoard.pressure[i] && music.midiChPlaying[i]) {
+    MIDI_api.notePressure(i, music.midiChPlaying[i], music.midiNotePlaying[i], hexBoard.pressure[i]);
+  }
+}
+
+// the left edge keys work the control wheels
+void key_handler_command(uint8_t i, uint8_t cmd) {
+  if (hexBoard.check_and_reset_just_pressed(i)) {
+    LEDs.set_held(i, true);
+    wheels.on_command_key(cmd, true);
+    if (cmd == _cmd_wheel_toggle) settings[_tglWheel].b = wheels.bend_on_keys;
+  } else if (hexBoard.check_and_reset_just_released(i)) {
+    LEDs.set_held(i, false);
+    wheels.on_command_key(cmd, false);
   }
 }
 
-void key_handler_hex_picker(Physical_Button& b) {
-  if (b.check_and_reset_just_pressed()) {
-    settings[_anchorX].i = b.coord.x;
-    settings[_anchorY].i = b.coord.y;
-  } else if (b.check_and_reset_just_released()) {
-    note_off(b);
-  } else if (b.pressure) {
+void key_handler_hex_picker(uint8_t i) {
+  if (hexBoard.check_and_reset_just_pressed(i)) {
+    settings[_anchorX].i = hexBoard.coord[i].x;
+    settings[_anchorY].i = hexBoard.coord[i].y;
+  } else if (hexBoard.check_and_reset_just_released(i)) {
+    note_off(i);
+  } else if (hexBoard.pressure[i]) {
     // nothing
   }
 }
 
-void key_handler_color_picker(Physical_Button& b) {
-  if (b.check_and_reset_just_pressed()) {
-    if (b.coord.y == -6) {
-      switch (b.coord.x) {
+void key_handler_color_picker(uint8_t i) {
+  const Hex& h = hexBoard.coord[i];
+  if (hexBoard.check_and_reset_just_pressed(i)) {
+    if (h.y == -6) {
+      switch (h.x) {
         case -4: settings[_hue_0].d = _hueY; break;
         case -2: settings[_hue_0].d = _hueC; break;
         case  0: settings[_hue_0].d = _hueG; break;
@@ -262,16 +578,78 @@ void key_handler_color_picker(Physical_Button& b) {
         case  4: settings[_hue_0].d = _hueR; break;
         case  6: settings[_hue_0].d = _hueB; break;
       }
-    } else if (b.coord.y == -4) {
-      settings[_hue_0].d += 3.0 * b.coord.x;
+    } else if (h.y == -4) {
+      settings[_hue_0].d += 3.0 * h.x;
     }
-  } else if (b.check_and_reset_just_released()) {
-    note_off(b);
-  } else if (b.pressure) {
+    on_setting_change(_hue_0);
+  } else if (hexBoard.check_and_reset_just_released(i)) {
+    note_off(i);
+  } else if (hexBoard.pressure[i]) {
     // nothing
   }
 }
 
+// applies a live parameter straight away. transpose only
+// reruns the pitch pass of the layout, from cached offsets.
+void set_live_value(uint8_t p, int32_t v) {
+  switch (p) {
+    case _live_transpose:
+      settings[_txposeS].i = v;
+      on_setting_change(_txposeS);
+      break;
+    case _live_program:
+      settings[_MIDIpc].i = v;
+      on_setting_change(_MIDIpc);
+      break;
+    case _live_brightness:
+      settings[_globlBrt].i = v;  // the LED timer picks it up
+      break;
+    case _live_volume:
+      settings[_synthVol].i = v;  // from the next note on
+      break;
+    case _live_mod:
+      wheels.wheel[_wheel_mod].set(v);   // see apply_wheels()
+      break;
+    case _live_bend:
+      wheels.wheel[_wheel_bend].set(v);
+      break;
+    default:
+      break;
+  }
+}
+
+void show_live_value() {
+  uint8_t p = dashboard.selected();
+  int32_t v = get_live_value(p);
+  bool signed_value = (live_parameters[p].min < 0);
+  char text[32];
+  int n = snprintf(text, sizeof(text), (signed_value ? "%s: %+ld" : "%s: %ld"),
+                   live_parameters[p].name, (long)v);
+  GUI.set_text(_GUI_dashboard, std::string_view(text, n));
+}
+
+void turn_live_value(int32_t detents) {
+  uint8_t p = dashboard.selected();
+  int32_t was = get_live_value(p);
+  int32_t v = Dashboard::stepped(p, was, detents);
+  if (v == was) return;
+  set_live_value(p, v);
+  show_live_value();
+  GUI.mark(_GUI_sliders);
+}
+
+// the menu and the play screen take turns
+void show_play_screen(bool on) {
+  if (on) {
+    menu.setMenuPageCurrent(pgNoMenu);
+    show_live_value();
+    GUI.add_context(_GUI_dashboard | _GUI_sliders);
+  } else {
+    GUI.remove_context(_GUI_dashboard | _GUI_sliders);
+    menu.setMenuPageCurrent(pgHome);
+  }
+}
+
 volatile bool doNotDrawMenu = false;
 void knob_handler_menu(const Rotary::Action& r) {
   // while dealing with rotary, halt OLED auto-update
@@ -321,7 +699,7 @@ void knob_handler_menu(const Rotary::Action& r) {
       if (menu_app_state() >= 2) {
         menu.registerKeyPress(GEM_KEY_OK);
       } else if (menu.getCurrentMenuPage() == &pgHome) {
-        menu.setMenuPageCurrent(pgNoMenu);
+        show_play_screen(true);
       } else {
         menu.registerKeyPress(GEM_KEY_CANCEL);
       }
@@ -336,27 +714,25 @@ void knob_handler_playback(const Rotary::Action& r) {
   switch (r) {
     case Rotary::Action::turn_CW:
     case Rotary::Action::turn_CW_with_press: {
-      // based on current live setting,
-      // change said setting by +1 on the fly
-      ++settings[_globlBrt].i;
+      turn_live_value(1);
       break;
     }
     case Rotary::Action::turn_CCW:
     case Rotary::Action::turn_CCW_with_press: {
-      // based on current live setting,
-      // change said setting by -1 on the fly
-      --settings[_globlBrt].i;
+      turn_live_value(-1);
       break;
     }
     case Rotary::Action::single_click_release:
     case Rotary::Action::double_click_release: {
-      // change live setting on the fly
-
+      // move on to the next live parameter
+      dashboard.next();
+      show_live_value();
+      GUI.mark(_GUI_sliders);
       break;
     }
     case Rotary::Action::long_press: {
       // long press changes to menu mode
-      menu.setMenuPageCurrent(pgHome);
+      show_play_screen(false);
       break;
     }
     default:                          break;
@@ -410,49 +786,135 @@ void hardware_test_mode() {
 }
 
 
+// the wheels move on a timer of their own so the rate of
+// updates doesn't depend on how busy loop() is
+struct repeating_timer polling_timer_wheel;
+bool on_wheel_tick(repeating_timer *t) {
+  wheels.tick();
+  return true;
+}
+
+// at most once per wheel tick: send the wheels that moved,
+// one message each (the MIDI queue keeps only the latest
+// of any still waiting), and update the synth.
+void apply_wheels() {
+  if (wheels.take_moved(_wheel_mod)) {
+    uint8_t ch[2];
+    uint8_t n = MIDI_api.zone_channels(music.channel[0], ch);  // every key plays on one channel
+    for (uint8_t k = 0; k < n; ++k) MIDI_api.sendMod(wheels.wheel[_wheel_mod].value, ch[k]);
+    for (size_t i = 0; i < buttons_count; ++i) {
+      if (!music.midiChPlaying[i]) continue;
+      MIDI_api.noteTimbre(i, music.midiChPlaying[i], music.midiNotePlaying[i], wheel_timbre());
+    }
+    remorph_synth_voices();
+    if (dashboard.selected() == _live_mod) show_live_value();
+    GUI.mark(_GUI_sliders);
+  }
+  if (wheels.take_moved(_wheel_bend)) {
+    uint8_t ch[2];
+    uint8_t n = MIDI_api.zone_channels(music.channel[0], ch);
+    for (uint8_t k = 0; k < n; ++k) MIDI_api.sendPitchBend(wheels.wheel[_wheel_bend].value, ch[k]);
+    update_synth_bend();
+    if (dashboard.selected() == _live_bend) show_live_value();
+    GUI.mark(_GUI_sliders);
+  }
+  // the velocity wheel is read at each note-on
+  wheels.take_moved(_wheel_velocity);
+}
+
+void configure_wheels() {
+  wheels.fine_tune = settings[_whlMode].b;
+  wheels.set_keyed_wheel(settings[_tglWheel].b);
+  wheels.wheel[_wheel_mod].sticky      = settings[_mdSticky].b;
+  wheels.wheel[_wheel_bend].sticky     = settings[_pbSticky].b;
+  wheels.wheel[_wheel_velocity].sticky = settings[_vlSticky].b;
+  wheels.wheel[_wheel_mod].step        = settings[_mdSpeed].i;
+  wheels.wheel[_wheel_bend].step       = settings[_pbSpeed].i * 128;
+  wheels.wheel[_wheel_velocity].step   = settings[_vlSpeed].i;
+}
+
+
 void on_setting_change(int s) {
+  OLED_damage.mark();
   switch (s) {
-    case _txposeS: case _txposeC:
-      // recalculate pitches for everyone
-      break;
     case _scaleLck:
       // set scale lock as appropriate
       break;
     case _MIDIusb: case _MIDIjack:
       // turn MIDI jacks on/off
+      MTS.invalidate();
+      send_tuning_table();
+      break;
+    case _MPEzoneC: case _MPEzoneL: case _MPEzoneR: case _MPEpb:
+      // the member channels are handed out afresh
+      if (MIDI_api.tuning_mode == _MIDImode_MPE) {
+        MIDI_api.releaseNotes(music.midiChPlaying, music.midiNotePlaying);
+      }
+      MIDI_api.configure_MPE(settings[_MPEzoneC].i, settings[_MPEzoneL].i,
+        settings[_MPEzoneR].i, settings[_MPEpb].i);
+      // the bend range also changes each note's bend word
+      if (s == _MPEpb) layout.on_setting_change(settings, s);
+      break;
+    case _MIDImode:
+      MIDI_api.releaseNotes(music.midiChPlaying, music.midiNotePlaying);
+      MIDI_api.set_mode(settings[_MIDImode].i);
+      MTS.invalidate();
+      layout.request(_relayout_pitch);
+      layout.update(settings);
+      after_relayout();
       break;    
     case _synthBuz: case _synthJac:
       Synth::set_pin(piezoPin, settings[_synthBuz].b);
       Synth::set_pin(audioJackPin, settings[_synthJac].b);
       break;    
-    case _MIDIpc: case _MT32pc:
+    case _MIDIpc:
+      // program numbers are 1 - 128 in the menu
+      MIDI_api.sendPC(settings[_MIDIpc].i - 1, 1);
+      break;
+    case _MT32pc:
       // send program change
       break;
+    case _clockMode:
+      set_clock_mode(settings[_clockMode].i);
+      break;
+    case _tempoBPM:
+      tempo.set_BPM(settings[_tempoBPM].i);
+      break;
     case _synthWav:
       pre_cache_synth_waveform(settings[_synthWav].i, cached_waveform); 
       break;
+    case _palette:
+      palette.set_mode(settings[_palette].i);
+      break;
+    case _tglWheel: case _whlMode:
+    case _mdSticky: case _pbSticky: case _vlSticky:
+    case _mdSpeed:  case _pbSpeed:  case _vlSpeed:
+      configure_wheels();
+      break;
+    case _pbRange:
+      update_synth_bend();
+      break;
+    case _hueLoop:
+      palette.set_loop(settings[_hueLoop].d);
+      break;
     /*
     _animFPS,  //
-    _palette,  //
     _animType, //
     _globlBrt, //
-    _hueLoop,  //
-    _tglWheel, //
-    _whlMode,  //
-    _mdSticky, //
-    _pbSticky, //
-    _vlSticky, //
-    _mdSpeed,  //
-    _pbSpeed,  //
-    _vlSpeed,  //
-    _MIDImode, //
-    _MPEzoneC, //
-    _MPEzoneL, //
-    _MPEzoneR, //
-    _MPEpb,    //
     _synthTyp, //
     */
     default: 
+      if (layout.on_setting_change(settings, s)) {
+        after_relayout();
+        // a relayout should fit within one LED frame
+        if (layout.last_relayout_uS > LED_poll_interval_mS * 1000) {
+          debug.add("relayout took ");
+          debug.add_num(layout.last_relayout_uS);
+          debug.add("uS\n");
+        }
+      } else {
+        palette.on_color_setting(settings, s);
+      }
       break;
   }
 }
@@ -490,7 +952,7 @@ void menu_handler(int m) {
       if (!Boot_Flags::fs_mounted = mount_file_system(true))
         return;
     }
-    menu.setMenuPageCurrent(pgNoMenu);
+    show_play_screen(true);
     boot_phase_one();
   } else if (m <= _trigger_save_layout) {
   } else if (m <= _trigger_load_layout) {
@@ -503,20 +965,28 @@ void menu_handler(int m) {
 
 struct repeating_timer polling_timer_LED;
 bool on_LED_frame_refresh(repeating_timer *t) {
-  for (auto& b : hexBoard.btn) {
-    Pixel_Data *p = static_cast<Pixel_Data*>(b.pxl_data_ptr);
-    strip.setPixelColor(b.pixel, p->LEDcode);
+  uint32_t now_uS = timer_hw->timerawl;
+  palette.advance(now_uS, LEDs);
+  animation.advance(now_uS, settings[_animFPS].i, LEDs,
+                    (tempo.is_running() ? tempo.beat_fraction(now_uS) : no_beat));
+  LEDs.set_brightness(settings[_globlBrt].i);
+  if (LEDs.refresh()) {
+    strip.show();
   }
-  strip.show();
   return true;
 }
 
 struct repeating_timer polling_timer_OLED;
 bool on_OLED_frame_refresh(repeating_timer *t) {
-  if (!doNotDrawMenu) {
-    menu.drawMenu();
-    oled_screensaver.jiggle();
-  }
+  if (doNotDrawMenu) return true;
+  if (!OLED_damage.due(GUI.take_dirty() != 0, timer_hw->timerawl)) return true;
+  OLED_pages.hold = true;
+  menu.drawMenu();
+  OLED_pages.hold = false;
+  OLED_pages.flush(u8g2);
+  oled_screensaver.jiggle();
+  // the DMA sends it while the next frame is drawn
+  OLED_DMA.submit();
   return true;
 }
 
@@ -533,16 +1003,15 @@ bool on_OLED_frame_refresh(repeating_timer *t) {
 
 
 void initialize_application() {
-  for (size_t i = 0; i < buttons_count; ++i) {
-    hexBoard.btn[i].app_data_ptr = static_cast<void*>(&music[i]);
-    hexBoard.btn[i].pxl_data_ptr = static_cast<void*>(&pixel[i]);
-  }
+  // button i plays music note i; nothing to link up
 }
 
 void initialize_settings() {
   load_factory_defaults_to(settings);
   debug.setStatus(&settings[_debug].b);
   oled_screensaver.setDelay(&settings[_SStime].i);
+  MIDI_api._ptr_UMIDI_active = &settings[_MIDIusb].b;
+  MIDI_api._ptr_SMIDI_active = &settings[_MIDIjack].b;
 }
 
 void setup() {
@@ -561,6 +1030,7 @@ void setup() {
   // display handlers
   add_repeating_timer_ms(OLED_poll_interval_mS, on_OLED_frame_refresh, NULL, &polling_timer_OLED);
   add_repeating_timer_ms(LED_poll_interval_mS, on_LED_frame_refresh, NULL, &polling_timer_LED);
+  add_repeating_timer_ms(wheel_poll_interval_mS, on_wheel_tick, NULL, &polling_timer_wheel);
   // if knob held down during boot, go into safe mode
   Boot_Flags::safe_mode = Rotary::getClickState();
   if (Boot_Flags::safe_mode) {
@@ -571,26 +1041,42 @@ void setup() {
     boot_phase_one();
   }
   apply_settings_to_objects();
+  if (menu.getCurrentMenuPage() == &pgNoMenu) show_play_screen(true);
 }
 
 void loop() {
+  read_MIDI_input();
   // key handler
   if (queue_try_remove(&Keys::msg_queue, &Keys::msg_out)) {
-    if (hexBoard.btn_at_index[Keys::msg_out.switch_number] == nullptr) {
+    uint8_t i = hexBoard.btn_at_index[Keys::msg_out.switch_number];
+    if (i == no_button) {
       if (hexBoard.dip_at_index[Keys::msg_out.switch_number] == nullptr) return;
       Hardwire_Switch* h = hexBoard.dip_at_index[Keys::msg_out.switch_number];
       h->state = Keys::msg_out.level;
       hardwired_switch_handler(*h);
       return;
     }
-    Physical_Button* b = hexBoard.btn_at_index[Keys::msg_out.switch_number];
-    b->update_levels(Keys::msg_out.timestamp, Keys::msg_out.level);
+    hexBoard.update_levels(i, Keys::msg_out.timestamp, Keys::msg_out.level);
     // can change this based on current key situation
-    key_handler_playback(*b);
+    uint8_t cmd = command_slot(hexBoard.coord[i].x, hexBoard.coord[i].y);
+    if (cmd != no_command) {
+      key_handler_command(i, cmd);
+    } else {
+      key_handler_playback(i);
+    }
+    GUI.mark(_GUI_input_monitor);
   }
+  apply_wheels();
+  // MIDI 2.0 packets from this pass go out together
+  MIDI_api.UMP.flush();
+  // then as much queued MIDI 1.0 as each port can take,
+  // clock bytes first
+  send_MIDI_clocks();
+  MIDI_api.service(timer_hw->timerawl);
   // knob handler
   if (queue_try_remove(&Rotary::act_queue, &Rotary::action_out)) {
     knob_handler_GUI(Rotary::action_out);
+    OLED_damage.mark_for(timer_hw->timerawl, GUI_arrowPersist_uS);
     if (menu.getCurrentMenuPage() == &pgNoMenu) {
       knob_handler_playback(Rotary::action_out);
     } else {
@@ -598,4 +1084,4 @@ void loop() {
     }
   }
   // LED and OLED displays run on a timer in the background
-}
+}
@@ -1,4 +1,8 @@
 #pragma once
+#include <stdint.h>
+#include <array>
+#include <bitset>
+#include "config.h"
 #include "color_conversion.h"
 #include <Adafruit_NeoPixel.h>  // library of code to interact with the LED array
 Adafruit_NeoPixel strip;
@@ -12,15 +16,149 @@ void connect_neoPixels(uint8_t pin, size_t numLEDs) {
   strip.show();
 }
 
-struct Pixel_Data {
-  uint32_t LEDcode = 0;
-
-  uint32_t baseRGBcolor = 0;
-  uint32_t cachedLEDcodeBase = 0; // calculate it once and store value, to make LED playback snappier 
-  uint32_t cachedLEDcodeAnim = 0; // calculate it once and store value, to make LED playback snappier 
-  uint32_t cachedLEDcodePlay = 0; // calculate it once and store value, to make LED playback snappier
-  uint32_t cachedLEDcodeRest = 0; // calculate it once and store value, to make LED playback snappier
-  uint32_t cachedLEDcodeOff  = 0; // calculate it once and store value, to make LED playback snappier
-  uint32_t cachedLEDcodeDim  = 0; // calculate it once and store value, to make LED playback snappier  
+// each LED color is built up from layers.
+// a layer is an array of packed 0xRRGGBB codes,
+// one per pixel, stored at full brightness.
+// the colors only need to go through OKHSV once,
+// when the layer is filled in.
+enum {
+  _LED_layer_base, // palette color of the key at rest
+  _LED_layer_play, // color of the key while it is held down
+  _LED_layer_anim, // animation overlay, added on top of the above
+  _LED_layer_count
 };
 
+// add two packed colors, channel by channel, capped at 255
+uint32_t add_RGB_saturate(uint32_t lhs, uint32_t rhs) {
+  uint32_t result = 0;
+  for (int shift = 0; shift < 24; shift += 8) {
+    uint32_t ch = ((lhs >> shift) & 0xFF) + ((rhs >> shift) & 0xFF);
+    result |= (ch > 0xFF ? 0xFF : ch) << shift;
+  }
+  return result;
+}
+
+// the compositor combines the layers into the code
+// sent to each pixel. only pixels whose inputs changed
+// since the last frame are recalculated, so a key press
+// touches one pixel and a brightness change is one
+// integer multiply per channel.
+//
+// brightness is applied in linear light, so each
+// channel comes out as a 16-bit value. NeoPixels only
+// take 8 bits, and at the "Dim" settings most of the
+// palette would round down to a handful of levels, or
+// to zero. instead the leftover low byte is carried
+// over to the next frame (temporal dithering), so at
+// 60 Hz the average output matches the 16-bit value.
+//
+// the compositor also keeps a running total of all
+// channel values, adjusted only when a pixel is
+// recomposed, to estimate the current draw. if a frame
+// would go over the budget, every pixel is scaled down
+// by the same factor so the board doesn't brown out.
+struct LED_Compositor {
+  std::array<std::array<uint32_t, buttons_count>, _LED_layer_count> layer;
+  std::array<std::array<uint16_t, 3>, buttons_count> linear;   // composed R, G, B
+  std::array<std::array<uint8_t,  3>, buttons_count> residual; // dither error carried forward
+  std::array<uint32_t, buttons_count> output;  // last code sent to each pixel
+  std::bitset<buttons_count> held;             // show the play layer instead of base
+  std::bitset<buttons_count> dirty;            // inputs changed since last refresh
+  std::bitset<buttons_count> fractional;       // has sub-LSB detail, needs dithering
+  uint8_t  globlBrt;                           // brightness setting, 0 - 255
+  uint16_t brightness;                         // same, in linear light 0 - 65535
+  uint32_t total_linear;                       // sum of every channel in linear[]
+  uint16_t budget_mA;
+  uint32_t limit;                              // power limit scale, 1 << 16 = none
+
+  LED_Compositor() 
+  : globlBrt(0), brightness(0), total_linear(0)
+  , budget_mA(LED_current_budget_mA), limit(1u << 16) {
+    for (auto& L : layer) L.fill(0);
+    for (auto& ch : linear) ch.fill(0);
+    for (auto& ch : residual) ch.fill(0);
+    output.fill(0);
+    dirty.set();
+  }
+  void set_layer(size_t L, size_t pxl, uint32_t code) {
+    if (layer[L][pxl] == code) return;
+    layer[L][pxl] = code;
+    dirty.set(pxl);
+  }
+  void set_held(size_t pxl, bool is_held) {
+    if (held[pxl] == is_held) return;
+    held[pxl] = is_held;
+    dirty.set(pxl);
+  }
+  // the setting is perceptual, so undo the sRGB gamma
+  // once here rather than per pixel.
+  void set_brightness(uint8_t new_globlBrt) {
+    if (globlBrt == new_globlBrt) return;
+    globlBrt = new_globlBrt;
+    brightness = lround(65535.f * srgb_transfer_function_inv(globlBrt / 255.f));
+    dirty.set();
+  }
+  void compose(size_t pxl) {
+    uint32_t code = layer[held[pxl] ? _LED_layer_play : _LED_layer_base][pxl];
+    code = add_RGB_saturate(code, layer[_LED_layer_anim][pxl]);
+    bool has_fraction = false;
+    for (size_t c = 0; c < 3; ++c) {
+      uint32_t ch = (code >> (16 - 8 * c)) & 0xFF;  // R, G, B
+      total_linear -= linear[pxl][c];
+      linear[pxl][c] = (ch * brightness) >> 8;     // at most 0xFF00
+      total_linear += linear[pxl][c];
+      residual[pxl][c] = 0;
+      has_fraction |= (linear[pxl][c] & 0xFF);
+    }
+    fractional[pxl] = has_fraction;
+  }
+  uint32_t idle_mA() const {
+    return LED_idle_mA_per_pixel * buttons_count;
+  }
+  uint32_t lit_mA() const {
+    return (uint64_t)total_linear * LED_channel_full_mA / 0xFF00;
+  }
+  uint32_t estimated_mA() const {
+    return idle_mA() + lit_mA();
+  }
+  // scale factor that brings the LED draw within budget
+  uint32_t power_limit() const {
+    if (estimated_mA() <= budget_mA) return (1u << 16);
+    if (budget_mA <= idle_mA()) return 0;
+    return ((budget_mA - idle_mA()) << 16) / lit_mA();
+  }
+  uint32_t dither(size_t pxl) {
+    uint32_t code = 0;
+    for (size_t c = 0; c < 3; ++c) {
+      uint16_t level = linear[pxl][c];
+      if (limit < (1u << 16)) level = (level * limit) >> 16;
+      uint16_t acc = level + residual[pxl][c];
+      residual[pxl][c] = acc & 0xFF;
+      code = (code << 8) | (acc >> 8);
+    }
+    return code;
+  }
+  // recalculate dirty pixels, step the dither on
+  // the rest, and pass any changes to the strip.
+  // returns true if the strip needs to be re-sent.
+  bool refresh() {
+    bool changed = false;
+    for (size_t pxl = 0; pxl < buttons_count; ++pxl) {
+      if (dirty[pxl]) compose(pxl);
+    }
+    uint32_t new_limit = power_limit();
+    // when limiting, every pixel is scaled and dithered
+    bool step_all = (new_limit != limit) || (new_limit < (1u << 16));
+    limit = new_limit;
+    for (size_t pxl = 0; pxl < buttons_count; ++pxl) {
+      if (!(dirty[pxl] || fractional[pxl] || step_all)) continue;
+      uint32_t code = dither(pxl);
+      if (code == output[pxl]) continue;
+      output[pxl] = code;
+      strip.setPixelColor(pxl, code);
+      changed = true;
+    }
+    dirty.reset();
+    return changed;
+  }
+};
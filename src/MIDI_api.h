@@ -3,13 +3,20 @@
 #pragma once
 #include <Adafruit_TinyUSB.h>   // library of code to get the USB port working
 #include <MIDI.h>               // library of code to send and receive MIDI messages
+#include <array>
 #include "pico/time.h"
-#include "pico/util/queue.h"
 #include "debug.h"
+#include "UMP.h"
+#include "MIDI_scheduler.h"
+
+// incoming SysEx has to fit a whole MTS bulk dump
+struct HexBoard_MIDI_Settings : public midi::DefaultSettings {
+  static const unsigned SysExMaxSize = 512;
+};
 
 Adafruit_USBD_MIDI usb_midi_over_Serial0;
-MIDI_CREATE_INSTANCE(Adafruit_USBD_MIDI, usb_midi_over_Serial0, UMIDI);
-MIDI_CREATE_INSTANCE(HardwareSerial, Serial1, SMIDI);
+MIDI_CREATE_CUSTOM_INSTANCE(Adafruit_USBD_MIDI, usb_midi_over_Serial0, UMIDI, HexBoard_MIDI_Settings);
+MIDI_CREATE_CUSTOM_INSTANCE(HardwareSerial, Serial1, SMIDI, HexBoard_MIDI_Settings);
 
 void mount_tinyUSB() {
   //uint32_t mountTime = timer_hw->timerawl;
@@ -23,6 +30,108 @@ void mount_tinyUSB() {
 
 
 
+// the scheduler hands each message to the port here.
+// USB goes as a 4-byte USB-MIDI event packet: cable 0,
+// code index = the status nibble for channel messages,
+// and 0xF (one byte) for real-time.
+int write_USB_MIDI(const MIDI_Message& msg) {
+  if (!TinyUSBDevice.mounted()) return 0;  // nobody to hear it
+  uint8_t length = MIDI_message_length(msg.status);
+  const uint8_t packet[4] = {
+    uint8_t(msg.status >> 4), msg.status,
+    (length >= 2 ? msg.data1 : uint8_t(0)),
+    (length == 3 ? msg.data2 : uint8_t(0))
+  };
+  return (tud_midi_packet_write(packet) ? 4 : -1);
+}
+DIN_Encoder DIN_encoder;
+int write_DIN_MIDI(const MIDI_Message& msg) {
+  uint8_t bytes[3];
+  size_t n = DIN_encoder.encode(msg, bytes, timer_hw->timerawl);
+  if (n) Serial1.write(bytes, n);
+  return n;
+}
+
+// MPE member channels, kept in two lists on fixed arrays.
+// free channels are handed out least recently released
+// first, so the release tail of a note isn't cut off by
+// the next note-on. if every channel is sounding, the
+// least recently started note is stolen. claiming and
+// releasing are O(1) list splices.
+const uint8_t MIDI_channel_count = 16;
+const uint16_t RPN_null = 0x3FFF;
+const uint8_t no_MPE_owner = 0xFF;
+enum {
+  _MPE_free_list = MIDI_channel_count + 1,  // channels are 1 - 16
+  _MPE_busy_list,
+  _MPE_list_size
+};
+enum {
+  _MPE_zone_lower,
+  _MPE_zone_upper,
+  _MPE_zone_both
+};
+
+struct MPE_Channel_Rotation {
+  std::array<uint8_t, _MPE_list_size> prev;
+  std::array<uint8_t, _MPE_list_size> next;
+  std::array<uint8_t, _MPE_list_size> owner;  // who is playing on each channel
+  std::array<uint8_t, _MPE_list_size> note;   // and what note number
+
+  MPE_Channel_Rotation() {
+    clear();
+  }
+  void clear() {
+    for (uint8_t c = 0; c < _MPE_list_size; ++c) {
+      prev[c]  = c;
+      next[c]  = c;
+      owner[c] = no_MPE_owner;
+      note[c]  = 0;
+    }
+  }
+  void unlink(uint8_t c) {
+    next[prev[c]] = next[c];
+    prev[next[c]] = prev[c];
+    prev[c] = c;
+    next[c] = c;
+  }
+  void push_back(uint8_t list, uint8_t c) {
+    prev[c] = prev[list];
+    next[c] = list;
+    next[prev[list]] = c;
+    prev[list] = c;
+  }
+  bool empty(uint8_t list) const {
+    return next[list] == list;
+  }
+  void add_member(uint8_t c) {
+    push_back(_MPE_free_list, c);
+  }
+  bool is_member(uint8_t c) const {
+    return (c >= 1) && (c <= MIDI_channel_count) && (next[c] != c);
+  }
+  // returns the channel. if it had to be stolen, the note
+  // it was playing is returned in stolen_note.
+  uint8_t claim(uint8_t who, uint8_t what, bool& stolen, uint8_t& stolen_note) {
+    stolen = empty(_MPE_free_list);
+    uint8_t c = next[stolen ? _MPE_busy_list : _MPE_free_list];
+    if (c >= _MPE_free_list) return 0;   // no member channels at all
+    stolen_note = note[c];
+    unlink(c);
+    push_back(_MPE_busy_list, c);
+    owner[c] = who;
+    note[c]  = what;
+    return c;
+  }
+  // false if the channel has since been given to someone else
+  bool release(uint8_t c, uint8_t who) {
+    if (!is_member(c) || (owner[c] != who)) return false;
+    unlink(c);
+    push_back(_MPE_free_list, c);
+    owner[c] = no_MPE_owner;
+    return true;
+  }
+};
 
 // a wrapper structure
 // which keeps track of MIDI-related options
@@ -37,30 +146,62 @@ struct MIDI_API_Object {
   bool * _ptr_UMIDI_active; // can read this on-the-fly
   bool * _ptr_SMIDI_active; // can read this on-the-fly
   int tuning_mode;   // get/set function, need to send a msg on each change
-  uint8_t MPE_zone_left;
-  uint8_t MPE_zone_right;
-  queue_t MPE_channel_queue;
+  uint8_t MPE_zones;
+  uint8_t MPE_zone_left;    // lower zone is channels 2 thru this one
+  uint8_t MPE_zone_right;   // upper zone is this channel thru 15
+  uint8_t MPE_bend_range;
+  MPE_Channel_Rotation MPE_channels;
+  UMP_Batch UMP;   // MIDI 2.0 packets waiting to go out
+  MIDI_Port_Scheduler USB_out;
+  MIDI_Port_Scheduler DIN_out;
+  bool DIN_was_on;
+  // RPNs sent in a batch leave the parameter selected, and
+  // the null RPN goes once per channel at the end of the
+  // batch -- or not at all, if skip_RPN_null is set.
+  bool    skip_RPN_null;
+  uint8_t RPN_batch_depth;
+  std::array<uint16_t, MIDI_channel_count + 1> RPN_selected;
 
+  MIDI_API_Object()
+  : _ptr_UMIDI_active(nullptr), _ptr_SMIDI_active(nullptr)
+  , tuning_mode(_MIDImode_standard)
+  , MPE_zones(_MPE_zone_lower), MPE_zone_left(9), MPE_zone_right(11)
+  , MPE_bend_range(48)
+  , USB_out(write_USB_MIDI, unlimited_bandwidth, 0)
+  , DIN_out(write_DIN_MIDI, DIN_uS_per_byte, DIN_burst_bytes), DIN_was_on(false)
+  , skip_RPN_null(false), RPN_batch_depth(0) {
+    RPN_selected.fill(RPN_null);
+  }
+
+  bool USB_on() const {
+    return (_ptr_UMIDI_active != nullptr) && *_ptr_UMIDI_active;
+  }
+  bool DIN_on() const {
+    return (_ptr_SMIDI_active != nullptr) && *_ptr_SMIDI_active;
+  }
+
+  // channel messages are queued, see MIDI_scheduler.h
   void send(uint8_t type, uint8_t data1, uint8_t data2, uint8_t ch) {
-    if (_ptr_UMIDI_active != nullptr) {
-      if (*_ptr_UMIDI_active) {
-        UMIDI.send(
-          static_cast<midi::MidiType>(type),
-          static_cast<midi::DataByte>(data1),
-          static_cast<midi::DataByte>(data2),
-          static_cast<midi::Channel>(ch)
-        );
-      }
-    }
-    if (_ptr_SMIDI_active != nullptr) {
-      if (*_ptr_SMIDI_active) {
-        SMIDI.send(
-          static_cast<midi::MidiType>(type),
-          static_cast<midi::DataByte>(data1),
-          static_cast<midi::DataByte>(data2),
-          static_cast<midi::Channel>(ch)
-        );
-      }
+    MIDI_Message msg = {
+      uint8_t((type & 0xF0) | ((ch - 1) & 0x0F)),
+      uint8_t(data1 & 0x7F), uint8_t(data2 & 0x7F)
+    };
+    if (USB_on()) USB_out.enqueue(msg);
+    if (DIN_on()) DIN_out.enqueue(msg);
+  }
+  // called every pass of loop()
+  void service(uint32_t now_uS) {
+    if (USB_on()) USB_out.service(now_uS); else USB_out.clear();
+    // a receiver plugged in after the port comes back on
+    // has to be sent every value, so the encoder forgets
+    // them when the port goes off, queue empty or not
+    if (DIN_on()) {
+      DIN_out.service(now_uS);
+      DIN_was_on = true;
+    } else if (DIN_was_on) {
+      DIN_out.clear();
+      DIN_encoder.reset();
+      DIN_was_on = false;
     }
   }
   void sendNoteOff(uint8_t note, uint8_t velo, uint8_t ch)    {send(0x80,note,velo,ch);}
@@ -70,13 +211,33 @@ struct MIDI_API_Object {
   void sendMod(uint8_t value, uint8_t ch)                     {sendCC(0x01,value,ch);}
   uint8_t MSB(uint16_t n)                                     {return (n >> 7) & 0x7F;}
   uint8_t LSB(uint16_t n)                                     {return n & 0x7F;}  
+  // value is 14 bits: data entry MSB, then LSB
   void sendRPN(uint16_t bank, uint16_t value, uint8_t ch) {
-    sendCC(0x64, LSB(bank), ch);
-    sendCC(0x65, MSB(bank), ch);
-    sendCC(0x06, LSB(value), ch);
-    sendCC(0x26, MSB(value), ch);
-    sendCC(0x64, 0x7F, ch);
-    sendCC(0x65, 0x7F, ch);
+    if (RPN_selected[ch] != bank) {
+      sendCC(0x65, MSB(bank), ch);
+      sendCC(0x64, LSB(bank), ch);
+      RPN_selected[ch] = bank;
+    }
+    sendCC(0x06, MSB(value), ch);
+    sendCC(0x26, LSB(value), ch);
+    if (RPN_batch_depth == 0) close_RPN(ch, true);
+  }
+  void close_RPN(uint8_t ch, bool send_null) {
+    if (RPN_selected[ch] == RPN_null) return;
+    if (send_null) {
+      sendCC(0x65, 0x7F, ch);
+      sendCC(0x64, 0x7F, ch);
+    }
+    RPN_selected[ch] = RPN_null;
+  }
+  void begin_RPNs() {
+    ++RPN_batch_depth;
+  }
+  void end_RPNs() {
+    if ((RPN_batch_depth == 0) || (--RPN_batch_depth > 0)) return;
+    for (uint8_t c = 1; c <= MIDI_channel_count; ++c) {
+      close_RPN(c, !skip_RPN_null);
+    }
   }
   void sendPitchBendRange(uint8_t semitones, uint8_t ch) {
     sendRPN(0x00, semitones << 7, ch);
@@ -91,42 +252,92 @@ struct MIDI_API_Object {
   void sendAfterTouch(uint8_t pres, uint8_t ch)               {send(0xD0,pres,0,ch);}
   void sendPitchBend(int16_t value, uint8_t ch) { uint16_t pb = uint16_t(value + 8192);
                                                   send(0xE0,LSB(pb),MSB(pb),ch);}
+  // clock, start, continue, stop
+  void sendRealTime(uint8_t status) {
+    MIDI_Message msg = {status, 0, 0};
+    if (USB_on()) USB_out.enqueue(msg);
+    if (DIN_on()) DIN_out.enqueue(msg);
+  }
+  // SysEx is written straight out, after anything queued
   void sendSysEx(const uint8_t* dataArray, size_t length) {
-    if (_ptr_UMIDI_active != nullptr) {
-      if (*_ptr_UMIDI_active) {UMIDI.sendSysEx(length, dataArray, false);}
+    if (USB_on()) {
+      USB_out.drain();
+      UMIDI.sendSysEx(length, dataArray, false);
     }
-    if (_ptr_SMIDI_active != nullptr) {
-      if (*_ptr_SMIDI_active) {SMIDI.sendSysEx(length, dataArray, false);}
+    if (DIN_on()) {
+      DIN_out.drain();
+      SMIDI.sendSysEx(length, dataArray, false);
+      DIN_encoder.cancel_running_status();
     }
   }
 
   
 
-  void reset_MPE_queue() {
-    uint8_t discard;
-    while (!queue_is_empty(&MPE_channel_queue)) {
-      queue_try_remove(&MPE_channel_queue, &discard);
-    }
-    uint8_t i = 2;
-    while (i <= MPE_zone_left) {
-      bool success = queue_try_add(&MPE_channel_queue, &i);
-      i += (uint8_t)success;
-    }
-    if (MPE_zone_right) {
-      i = MPE_zone_right;
-      while (i <= 15) {
-        bool success = queue_try_add(&MPE_channel_queue, &i);
-        i += (uint8_t)success;
+  // where a control for every note (the mod and pitch
+  // wheels) goes: each MPE zone's master channel, or else
+  // the channel the notes are on. returns how many.
+  uint8_t zone_channels(uint8_t note_channel, uint8_t out[2]) const {
+    if (tuning_mode != _MIDImode_MPE) {
+      out[0] = note_channel;
+      return 1;
+    }
+    uint8_t n = 0;
+    if (lower_zone_on()) out[n++] = 1;
+    if (upper_zone_on()) out[n++] = 16;
+    return n;
+  }
+  bool lower_zone_on() const {
+    return (MPE_zones != _MPE_zone_upper) && (MPE_zone_left >= 2);
+  }
+  bool upper_zone_on() const {
+    return (MPE_zones != _MPE_zone_lower) && (MPE_zone_right <= 15);
+  }
+  void reset_MPE_channels() {
+    MPE_channels.clear();
+    if (lower_zone_on()) {
+      for (uint8_t c = 2; c <= MPE_zone_left; ++c) {
+        MPE_channels.add_member(c);
+      }
+    }
+    if (upper_zone_on()) {
+      for (uint8_t c = MPE_zone_right; c <= 15; ++c) {
+        if (!MPE_channels.is_member(c)) MPE_channels.add_member(c);
       }
     }
   }
+  // MPE configuration message on each master channel,
+  // then the pitch bend range on every member channel.
   void switch_on_MPE() {
-    // PB range
-    // MPE zones
-    reset_MPE_queue();
+    reset_MPE_channels();
+    begin_RPNs();
+    sendMPEzone(lower_zone_on() ? MPE_zone_left - 1 : 0, 1);
+    sendMPEzone(upper_zone_on() ? 16 - MPE_zone_right : 0, 16);
+    for (uint8_t c = 2; c <= 15; ++c) {
+      if (MPE_channels.is_member(c)) sendPitchBendRange(MPE_bend_range, c);
+    }
+    end_RPNs();
+  }
+  void switch_off_MPE() {
+    begin_RPNs();
+    sendMPEzone(0, 1);
+    sendMPEzone(0, 16);
+    end_RPNs();
+    MPE_channels.clear();
+  }
+
+  void configure_MPE(uint8_t zones, uint8_t left, uint8_t right, uint8_t bend_range) {
+    MPE_zones      = zones;
+    MPE_zone_left  = (left  > 15 ? 15 : left);
+    MPE_zone_right = (right <  2 ?  2 : right);
+    MPE_bend_range = bend_range;
+    if (tuning_mode == _MIDImode_MPE) switch_on_MPE();
   }
 
   void set_mode(int m) {
+    begin_RPNs();
+    if ((tuning_mode == _MIDImode_MPE) && (m != _MIDImode_MPE)) {
+      switch_off_MPE();
+    }
     tuning_mode = m;
     switch (m) {
 
@@ -137,6 +348,7 @@ struct MIDI_API_Object {
       default:
         break;
     }    
+    end_RPNs();
   }
 /*
   int16_t getBend(uint8_t pitchBendRange) {
@@ -148,74 +360,157 @@ struct MIDI_API_Object {
   }
 */
 
-  void noteOn(uint8_t channel, uint8_t table, double note, uint8_t velocity) {
+  // who = the button playing the note. returns the
+  // channel the note went out on, to pass to noteOff.
+  uint8_t noteOn(uint8_t who, uint8_t channel, uint8_t table, uint16_t bend, uint16_t pitch_7_9, uint8_t velocity, uint8_t timbre) {
     switch (tuning_mode) {
       case _MIDImode_standard:
       case _MIDImode_tuning_table: {
         sendNoteOn(table, velocity, channel);
-        break;
+        return channel;
       }
-      // MTS mode and 1.0 mode:
-      // noteOn, interpret straight
-      // CC messages, interpret straight
-      // MTS, have a tuning table dump first.
-      // also allow for option to listen for
-      // bulk tuning message
+      // MPE: each note gets its own member channel, with
+      // the pitch bend, pressure and timbre for that channel
+      // set before the note-on, per the MPE spec.
       case _MIDImode_MPE: {
-        // get algorithm from hb 1.1
-
+        bool    stolen;
+        uint8_t stolen_note;
+        uint8_t c = MPE_channels.claim(who, table, stolen, stolen_note);
+        if (c == 0) return 0;
+        if (stolen) sendNoteOff(stolen_note, 0, c);
+        sendCC(0x4A, timbre, c);
+        sendAfterTouch(0, c);
+        sendPitchBend(int16_t(bend) - 8192, c);
+        sendNoteOn(table, velocity, c);
+        return c;
       }
-      // noteOn, assign open channel, bend pitch
-      // CC messages, send to master channel (1/16)
 
+      // MIDI 2.0: one packet carries the exact pitch
       case _MIDImode_2_point_oh: {
-
+        UMP.note_on(channel, table, velocity, pitch_7_9);
+        if (timbre != 0x40) noteTimbre(who, channel, table, timbre);
+        return channel;
       }
-      // different format, look at spec
 
       default: 
-        break;
+        return 0;
     }
   }
 
-  void noteOff(uint8_t channel, uint8_t table, double note, uint8_t velocity) {
+  void noteOff(uint8_t who, uint8_t channel, uint8_t table, uint8_t velocity) {
+    if (channel == 0) return;  // never went out, or already let go
     switch (tuning_mode) {
       case _MIDImode_standard:
       case _MIDImode_tuning_table: {
         sendNoteOff(table, velocity, channel);
         break;
       }
-      // MTS mode and 1.0 mode:
-      // noteOn, interpret straight
-      // CC messages, interpret straight
-      // MTS, have a tuning table dump first.
-      // also allow for option to listen for
-      // bulk tuning message
       case _MIDImode_MPE: {
-        // get algorithm from hb 1.1
-
+        // skip if the channel was stolen by a later note
+        if (MPE_channels.release(channel, who)) {
+          sendNoteOff(table, velocity, channel);
+        }
+        break;
       }
-      // noteOn, assign open channel, bend pitch
-      // CC messages, send to master channel (1/16)
 
       case _MIDImode_2_point_oh: {
-
+        UMP.note_off(channel, table, velocity);
+        break;
       }
-      // different format, look at spec
 
       default: 
         break;
     }
   }
 
+  // per-note expression. in MPE mode this goes on the
+  // note's own channel, otherwise as poly aftertouch.
+  // channel 0 means the note never went out.
+  void notePressure(uint8_t who, uint8_t channel, uint8_t table, uint8_t pressure) {
+    if (channel == 0) return;
+    if (tuning_mode == _MIDImode_2_point_oh) {
+      UMP.poly_pressure(channel, table, UMP_upscale_32(pressure));
+    } else if (tuning_mode == _MIDImode_MPE) {
+      if (MPE_channels.owner[channel] == who) sendAfterTouch(pressure, channel);
+    } else {
+      sendAfterTouch(table, pressure, channel);
+    }
+  }
+  void noteTimbre(uint8_t who, uint8_t channel, uint8_t table, uint8_t timbre) {
+    if (channel == 0) return;
+    if (tuning_mode == _MIDImode_2_point_oh) {
+      UMP.per_note_controller(channel, table, 0x4A, UMP_upscale_32(timbre), false);
+    } else if (tuning_mode == _MIDImode_MPE) {
+      if (MPE_channels.owner[channel] == who) sendCC(0x4A, timbre, channel);
+    }
+  }
+  // bend a single note. bend is 32 bits, centered at UMP_bend_center.
+  // in MPE mode it goes out as the 14-bit bend of the note's channel.
+  void notePitchBend(uint8_t who, uint8_t channel, uint8_t table, uint32_t bend) {
+    if (channel == 0) return;
+    if (tuning_mode == _MIDImode_2_point_oh) {
+      UMP.per_note_pitch_bend(channel, table, bend);
+    } else if (tuning_mode == _MIDImode_MPE) {
+      if (MPE_channels.owner[channel] == who) sendPitchBend(int16_t(bend >> 18) - 8192, channel);
+    }
+  }
+  // note-offs for every note still sounding, while the
+  // channels are what they were when the notes started.
+  // call before set_mode() or configure_MPE(): after, a
+  // note held on channel 1 or on an MPE channel handed out
+  // before the change can't be released. channel[] is
+  // zeroed, so the key's own note-off sends nothing.
+  template <size_t N>
+  void releaseNotes(std::array<uint8_t, N>& channel, const std::array<uint8_t, N>& table) {
+    for (size_t i = 0; i < N; ++i) {
+      if (channel[i] == 0) continue;
+      noteOff(i, channel[i], table[i], 0);
+      channel[i] = 0;
+    }
+  }
+  // move a held note to a new pitch (in MIDI note numbers).
+  // the MPE channel bend is from the note number; the
+  // MIDI 2.0 per-note bend is from the pitch the note-on
+  // carried, played_7_9.
+  void noteRetune(uint8_t who, uint8_t channel, uint8_t table, uint16_t played_7_9, double pitch) {
+    double semitones, range;
+    if (tuning_mode == _MIDImode_MPE) {
+      semitones = pitch - table;
+      range     = MPE_bend_range;
+    } else if (tuning_mode == _MIDImode_2_point_oh) {
+      semitones = pitch - played_7_9 / 512.0;
+      range     = UMP_per_note_bend_range;
+    } else {
+      return;
+    }
+    if (range <= 0) return;
+    double b = UMP_bend_center * (1.0 + semitones / range);
+    notePitchBend(who, channel, table, uint32_t(b < 0 ? 0 : (b > 4294967295.0 ? 4294967295.0 : b)));
+  }
+
 
 };
 
 MIDI_API_Object        MIDI_api;
+
+// the UMP sink until there is a MIDI 2.0 endpoint: each
+// packet goes out on the MIDI 1.0 ports, see UMP.h
+void send_UMP_as_MIDI_1(const uint32_t* words, size_t count) {
+  uint8_t status, data1, data2;
+  for (size_t k = 0; k + 1 < count; k += 2) {
+    if (UMP_to_MIDI_1(words[k], words[k + 1], status, data1, data2)) {
+      MIDI_api.send(status, data1, data2, (status & 0x0F) + 1);
+    }
+  }
+}
+
 void init_MIDI() {
   usb_midi_over_Serial0.setStringDescriptor("HexBoard MIDI");  // Initialize MIDI, and listen to all MIDI channels
   UMIDI.begin(MIDI_CHANNEL_OMNI);                 // This will also call usb_midi's begin()
   SMIDI.begin(MIDI_CHANNEL_OMNI);
-  queue_init(&(MIDI_api.MPE_channel_queue), sizeof(uint8_t), 15);
+  // input is played here, not echoed back out
+  UMIDI.turnThruOff();
+  SMIDI.turnThruOff();
+  MIDI_api.UMP.sink = send_UMP_as_MIDI_1;
 }
 
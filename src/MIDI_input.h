@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+#include "config.h"
+#include "hexBoardGrid.h"
+
+/*
+ *  MIDI coming in.
+ *
+ *  Both ports are read every pass of loop(), for at most
+ *  MIDI_input_budget_uS so a flood of input can't stall the
+ *  keys. Notes play on the built-in synth and light every
+ *  hex that sends that note number, so the HexBoard also
+ *  works as a sound module.
+ *
+ *  Pitch_Index is the reverse of music.table: from a MIDI
+ *  note number to the buttons that play it, as a chain on
+ *  fixed arrays. It is rebuilt after each relayout.
+ */
+
+const uint32_t MIDI_input_budget_uS = 500;
+
+struct Pitch_Index {
+  std::array<uint8_t, 128>           first;
+  std::array<uint8_t, buttons_count> next;
+
+  Pitch_Index() {
+    first.fill(no_button);
+    next.fill(no_button);
+  }
+  // walk with: for (b = first[n]; b != no_button; b = next[b])
+  void build(const std::array<uint8_t, buttons_count>& table) {
+    first.fill(no_button);
+    for (size_t i = buttons_count; i-- > 0;) {
+      uint8_t n = table[i] & 0x7F;
+      next[i]  = first[n];
+      first[n] = i;
+    }
+  }
+};
+
+// notes from outside that hold a synth voice
+struct External_Note {
+  bool    active = false;
+  uint8_t channel = 0;
+  uint8_t note = 0;
+  uint8_t voice = 0;    // 1 - synth_polyphony_limit, 0 = no voice
+};
+
+struct External_Notes {
+  std::array<External_Note, synth_polyphony_limit> slot;
+
+  External_Note* find(uint8_t channel, uint8_t note) {
+    for (auto& n : slot) {
+      if (n.active && (n.channel == channel) && (n.note == note)) return &n;
+    }
+    return nullptr;
+  }
+  External_Note* open() {
+    for (auto& n : slot) {
+      if (!n.active) return &n;
+    }
+    return nullptr;
+  }
+};
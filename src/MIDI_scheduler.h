@@ -0,0 +1,341 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+#include "pico/time.h"
+
+/*
+ *  MIDI output scheduling.
+ *
+ *  Channel messages are not written to the ports as they
+ *  are made. Each port has two fixed queues: notes (on /
+ *  off) go out first, then everything else. Continuous
+ *  controllers -- pitch bend, pressure, CCs -- replace the
+ *  value of a message still waiting for the same thing
+ *  instead of queueing another one, so a storm of pressure
+ *  updates is only ever one message per key or channel.
+ *
+ *  Each port has a byte budget that fills up at the speed
+ *  of the wire (DIN is 31250 baud, 320 uS per byte) and the
+ *  queues are drained in loop() as far as the budget goes,
+ *  notes first. USB has no budget; packets go out until the
+ *  endpoint buffer is full.
+ *
+ *  Order on one channel is kept: when a note is queued, any
+ *  controllers still waiting on that channel are moved in
+ *  front of it (an MPE note needs its pitch bend first).
+ *  Real-time bytes (MIDI clock) go ahead of everything.
+ *
+ *  A full queue writes its oldest message out on the spot
+ *  (for the controls, after the queued notes, which are
+ *  older than any control left on their channel). Only a
+ *  continuous controller is let go instead, as the next
+ *  one makes up for it; an RPN or data entry never is (the
+ *  MPE setup is some 90 of them in one go). A port
+ *  that takes nothing for MIDI_force_timeout_uS, like USB
+ *  with no host reading, is stalled: what it was forced to
+ *  write is dropped until it takes a message again.
+ */
+
+const size_t   MIDI_queue_size     = 64;
+const uint32_t DIN_uS_per_byte     = 320;    // 10 bits at 31250 baud
+const uint32_t DIN_burst_bytes     = 32;     // the UART transmit FIFO
+const uint32_t unlimited_bandwidth = 0;
+const uint32_t MIDI_force_timeout_uS = 2000;
+
+struct MIDI_Message {
+  uint8_t status;   // type | (channel - 1)
+  uint8_t data1;
+  uint8_t data2;
+};
+
+bool MIDI_is_realtime(uint8_t status) {
+  return status >= 0xF8;
+}
+uint8_t MIDI_message_length(uint8_t status) {
+  if (MIDI_is_realtime(status)) return 1;
+  uint8_t type = status & 0xF0;
+  return ((type == 0xC0) || (type == 0xD0) ? 2 : 3);
+}
+bool MIDI_is_note(uint8_t status) {
+  uint8_t type = status & 0xF0;
+  return (type == 0x80) || (type == 0x90);
+}
+// a later message of the same kind makes this one pointless.
+// (N)RPN and data entry CCs only mean something in sequence,
+// and channel mode messages (0x78 up: all notes off, reset
+// all controllers...) are commands, not values.
+bool MIDI_is_continuous(uint8_t status, uint8_t data1) {
+  switch (status & 0xF0) {
+    case 0xA0: case 0xD0: case 0xE0:
+      return true;
+    case 0xB0:
+      return (data1 != 0x06) && (data1 != 0x26)
+          && ((data1 < 0x60) || (data1 > 0x65))
+          && (data1 < 0x78);
+    default:
+      return false;
+  }
+}
+bool MIDI_supersedes(const MIDI_Message& later, const MIDI_Message& earlier) {
+  if (later.status != earlier.status) return false;
+  uint8_t type = later.status & 0xF0;
+  // CCs and poly pressure are per controller / per key
+  if ((type == 0xB0) || (type == 0xA0)) return later.data1 == earlier.data1;
+  return true;
+}
+
+struct MIDI_Queue {
+  std::array<MIDI_Message, MIDI_queue_size> m;
+  uint8_t head;
+  uint8_t count;
+
+  MIDI_Queue() : head(0), count(0) {}
+
+  bool empty() const { return count == 0; }
+  bool full()  const { return count == MIDI_queue_size; }
+  MIDI_Message& at(size_t k) { return m[(head + k) % MIDI_queue_size]; }
+  const MIDI_Message& front() const { return m[head]; }
+  void push(const MIDI_Message& msg) {
+    m[(head + count) % MIDI_queue_size] = msg;
+    ++count;
+  }
+  void pop() {
+    head = (head + 1) % MIDI_queue_size;
+    --count;
+  }
+  void erase(size_t k) {
+    for (; k + 1 < count; ++k) {
+      at(k) = at(k + 1);
+    }
+    --count;
+  }
+};
+
+// returns the bytes that went on the wire (which can be
+// fewer than the message, or none), or -1 if the port
+// can't take the message right now.
+using MIDI_Port_Writer = int (*)(const MIDI_Message& msg);
+
+struct MIDI_Port_Scheduler {
+  MIDI_Queue       realtime;
+  MIDI_Queue       notes;
+  MIDI_Queue       controls;
+  MIDI_Port_Writer writer;
+  uint32_t uS_per_byte;     // 0 = no limit
+  uint32_t burst_bytes;
+  uint32_t credit_uS;       // wire time available now
+  uint32_t last_uS;
+  uint32_t sent_bytes;
+  uint32_t dropped;         // lost to a full queue or a stalled port
+  bool     stalled;
+
+  MIDI_Port_Scheduler(MIDI_Port_Writer w, uint32_t per_byte, uint32_t burst)
+  : writer(w), uS_per_byte(per_byte), burst_bytes(burst)
+  , credit_uS(per_byte * burst), last_uS(0), sent_bytes(0), dropped(0)
+  , stalled(false) {}
+
+  bool idle() const {
+    return realtime.empty() && notes.empty() && controls.empty();
+  }
+  void clear() {
+    realtime = MIDI_Queue();
+    notes    = MIDI_Queue();
+    controls = MIDI_Queue();
+    stalled  = false;
+  }
+
+  // write the message, budget or not. used when a queue
+  // overflows and for SysEx, which must not overtake notes.
+  void force(const MIDI_Message& msg) {
+    uint32_t start_uS = timer_hw->timerawl;
+    int n;
+    while ((n = writer(msg)) < 0) {
+      if (stalled || (timer_hw->timerawl - start_uS > MIDI_force_timeout_uS)) {
+        stalled = true;
+        ++dropped;
+        return;
+      }
+    }
+    stalled = false;
+    sent_bytes += n;
+  }
+  void drain() {
+    for (; !realtime.empty(); realtime.pop()) force(realtime.front());
+    for (; !notes.empty(); notes.pop())       force(notes.front());
+    for (; !controls.empty(); controls.pop()) force(controls.front());
+  }
+
+  void enqueue(const MIDI_Message& msg) {
+    if (MIDI_is_realtime(msg.status)) {
+      if (realtime.full()) { force(realtime.front()); realtime.pop(); }
+      realtime.push(msg);
+      return;
+    }
+    if (MIDI_is_note(msg.status)) {
+      // controllers waiting on this channel go first
+      uint8_t ch = msg.status & 0x0F;
+      for (size_t k = 0; k < controls.count;) {
+        if ((controls.at(k).status & 0x0F) != ch) { ++k; continue; }
+        if (notes.full()) { force(notes.front()); notes.pop(); }
+        notes.push(controls.at(k));
+        controls.erase(k);
+      }
+      if (notes.full()) { force(notes.front()); notes.pop(); }
+      notes.push(msg);
+      return;
+    }
+    if (MIDI_is_continuous(msg.status, msg.data1)) {
+      for (size_t k = 0; k < controls.count; ++k) {
+        if (MIDI_supersedes(msg, controls.at(k))) {
+          controls.at(k) = msg;
+          return;
+        }
+      }
+    }
+    if (controls.full()) {
+      const MIDI_Message& oldest = controls.front();
+      if (MIDI_is_continuous(oldest.status, oldest.data1)) {
+        ++dropped;
+      } else {
+        for (; !notes.empty(); notes.pop()) force(notes.front());
+        force(oldest);
+      }
+      controls.pop();
+    }
+    controls.push(msg);
+  }
+
+  bool afford(const MIDI_Message& msg) const {
+    return (uS_per_byte == unlimited_bandwidth)
+        || (credit_uS >= uS_per_byte * MIDI_message_length(msg.status));
+  }
+  bool send_front(MIDI_Queue& q) {
+    const MIDI_Message& msg = q.front();
+    if (!afford(msg)) return false;
+    int n = writer(msg);
+    if (n < 0) return false;
+    stalled = false;
+    sent_bytes += n;
+    if (uS_per_byte != unlimited_bandwidth) credit_uS -= uS_per_byte * n;
+    q.pop();
+    return true;
+  }
+
+  // called every pass of loop()
+  void service(uint32_t now_uS) {
+    if (uS_per_byte != unlimited_bandwidth) {
+      credit_uS += now_uS - last_uS;
+      uint32_t cap = uS_per_byte * burst_bytes;
+      if (credit_uS > cap) credit_uS = cap;
+    }
+    last_uS = now_uS;
+    while (!realtime.empty()) {
+      if (!send_front(realtime)) return;
+    }
+    while (!notes.empty()) {
+      if (!send_front(notes)) return;   // controls never overtake a note
+    }
+    while (!controls.empty()) {
+      if (!send_front(controls)) return;
+    }
+  }
+};
+
+/*
+ *  DIN wire encoding.
+ *
+ *  At 320 uS a byte, every byte saved on the jack counts.
+ *  A status byte is left out when it is the same as the
+ *  last one (running status), and a note-off with zero
+ *  velocity goes as a note-on with zero velocity so it
+ *  can run on from the note-ons. A CC, pitch bend or
+ *  channel pressure that repeats the value the channel
+ *  already has is not sent at all. The status is sent in
+ *  full again now and then, in case a receiver was
+ *  plugged in mid-stream.
+ */
+
+const uint32_t DIN_status_refresh_uS = 200000;
+const uint8_t  DIN_unknown_value     = 0xFF;
+const uint16_t DIN_unknown_bend      = 0xFFFF;
+
+struct DIN_Encoder {
+  uint8_t  running_status;  // 0 = none
+  uint32_t status_sent_uS;
+  std::array<std::array<uint8_t, 128>, 16> CC_value;
+  std::array<uint16_t, 16> bend_value;
+  std::array<uint8_t, 16>  pressure_value;
+
+  DIN_Encoder() {
+    reset();
+  }
+  // forget everything, e.g. after the port was off
+  void reset() {
+    running_status = 0;
+    for (auto& ch : CC_value) ch.fill(DIN_unknown_value);
+    bend_value.fill(DIN_unknown_bend);
+    pressure_value.fill(DIN_unknown_value);
+  }
+  void forget_channel(uint8_t ch) {
+    CC_value[ch].fill(DIN_unknown_value);
+    bend_value[ch]     = DIN_unknown_bend;
+    pressure_value[ch] = DIN_unknown_value;
+  }
+  // SysEx or anything else sent around the encoder
+  // cancels running status
+  void cancel_running_status() {
+    running_status = 0;
+  }
+
+  bool repeats_value(const MIDI_Message& msg) {
+    uint8_t ch = msg.status & 0x0F;
+    switch (msg.status & 0xF0) {
+      case 0xB0: {
+        // only plain controllers. a repeated data entry
+        // or (N)RPN select means something. after a reset
+        // all controllers the receiver's values are its own.
+        if (msg.data1 == 0x79) forget_channel(ch);
+        if (!MIDI_is_continuous(msg.status, msg.data1)) return false;
+        if (CC_value[ch][msg.data1] == msg.data2) return true;
+        CC_value[ch][msg.data1] = msg.data2;
+        return false;
+      }
+      case 0xE0: {
+        uint16_t pb = (msg.data2 << 7) | msg.data1;
+        if (bend_value[ch] == pb) return true;
+        bend_value[ch] = pb;
+        return false;
+      }
+      case 0xD0: {
+        if (pressure_value[ch] == msg.data1) return true;
+        pressure_value[ch] = msg.data1;
+        return false;
+      }
+      default:
+        return false;
+    }
+  }
+
+  // fills out[] with the bytes to send, returns how many
+  size_t encode(const MIDI_Message& msg, uint8_t out[3], uint32_t now_uS) {
+    // real-time bytes leave running status alone
+    if (MIDI_is_realtime(msg.status)) {
+      out[0] = msg.status;
+      return 1;
+    }
+    if (repeats_value(msg)) return 0;
+    uint8_t status = msg.status;
+    if (((status & 0xF0) == 0x80) && (msg.data2 == 0)) {
+      status = 0x90 | (status & 0x0F);
+    }
+    size_t n = 0;
+    if ((status != running_status) || (now_uS - status_sent_uS > DIN_status_refresh_uS)) {
+      out[n++] = status;
+      running_status = status;
+      status_sent_uS = now_uS;
+    }
+    out[n++] = msg.data1;
+    if (MIDI_message_length(status) == 3) out[n++] = msg.data2;
+    return n;
+  }
+};
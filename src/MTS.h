@@ -0,0 +1,248 @@
+#pragma once
+#include <stdint.h>
+#include <cmath>
+#include <array>
+#include <bitset>
+#include "config.h"
+
+/*
+ *  MIDI Tuning Standard.
+ *
+ *  In _MIDImode_tuning_table every distinct pitch on the
+ *  board gets its own MIDI note number ("slot"), and the
+ *  synth is told what frequency each slot plays with a
+ *  tuning SysEx. Notes are then plain note-on / note-off
+ *  with no pitch bend traffic.
+ *
+ *  The slots are worked out after each relayout. Only the
+ *  slots whose tuning changed are sent: as single note
+ *  tuning changes if that is shorter, otherwise as a bulk
+ *  dump of all 128. The messages are built in a fixed
+ *  buffer, without the F0 / F7 (MIDI.h adds those).
+ *
+ *  The other way round, MTS_Received keeps the tuning that
+ *  another device sent us, for notes coming in over MIDI.
+ */
+
+const size_t  MTS_slot_count      = 128;
+const uint8_t MTS_device_all      = 0x7F;
+const uint8_t MTS_tuning_program  = 0;
+const size_t  MTS_name_length     = 16;
+// 7E dev 08 01 prog name[16] 128 x (xx yy zz) checksum
+const size_t  MTS_bulk_length     = 5 + MTS_name_length + 3 * MTS_slot_count + 1;
+// 7F dev 08 02 prog count, then (key xx yy zz) per note
+const size_t  MTS_single_header   = 6;
+const size_t  MTS_single_max_keys = 127;
+// single note changes are only sent when shorter than a bulk dump
+const size_t  MTS_buffer_length   = MTS_bulk_length;
+
+// pitches closer than this (in semitones) share a slot
+const double  MTS_same_pitch      = 0.0001;
+
+// MTS frequency word: semitone, then 14 bits of fraction
+// of a semitone. 0x7F7F7F is reserved for "no change".
+uint32_t MTS_frequency_word(double midi_pitch) {
+  if (midi_pitch < 0.0) midi_pitch = 0.0;
+  long units = lround(midi_pitch * 16384.0);
+  const long highest = (127L << 14) | 0x3FFE;
+  if (units > highest) units = highest;
+  return ((units >> 14) << 16) | (((units >> 7) & 0x7F) << 8) | (units & 0x7F);
+}
+
+struct MTS_Tuning {
+  std::array<uint32_t, MTS_slot_count> word;  // frequency word of each slot
+  std::bitset<MTS_slot_count>          changed;
+  std::array<uint8_t, buttons_count>   order; // buttons sorted by pitch
+  std::array<uint8_t, MTS_buffer_length> buffer;
+  size_t length;
+
+  MTS_Tuning() : length(0) {
+    for (size_t s = 0; s < MTS_slot_count; ++s) {
+      word[s] = s << 16; // 12EDO, slot = MIDI note
+    }
+    for (size_t i = 0; i < buttons_count; ++i) {
+      order[i] = i;
+    }
+    changed.set();
+  }
+
+  // send everything on the next message, e.g. when
+  // the mode is switched on or a synth is plugged in
+  void invalidate() {
+    changed.set();
+  }
+
+  void set_slot(size_t s, uint32_t w) {
+    if (word[s] == w) return;
+    word[s] = w;
+    changed.set(s);
+  }
+
+  // give each distinct pitch a slot, keeping slots as
+  // close to the nearest 12EDO note as the order allows.
+  // writes the slot of each button into table.
+  void assign(const std::array<double, buttons_count>& note,
+              std::array<uint8_t, buttons_count>& table) {
+    // the previous order is nearly sorted after a small
+    // change, so insertion sort is close to one pass
+    for (size_t i = 1; i < buttons_count; ++i) {
+      uint8_t b = order[i];
+      size_t j = i;
+      while ((j > 0) && (note[order[j - 1]] > note[b])) {
+        order[j] = order[j - 1];
+        --j;
+      }
+      order[j] = b;
+    }
+    // slots going up: at least the next free slot
+    std::array<int, buttons_count> slot;
+    std::array<bool, buttons_count> shares; // same pitch as the one before
+    int next = 0;
+    for (size_t k = 0; k < buttons_count; ++k) {
+      double n = note[order[k]];
+      shares[k] = (k > 0) && (n - note[order[k - 1]] < MTS_same_pitch);
+      if (shares[k]) {
+        slot[k] = slot[k - 1];
+        continue;
+      }
+      long nearest = lround(n);
+      slot[k] = (nearest > next ? nearest : next);
+      next = slot[k] + 1;
+    }
+    // slots coming down: leave room for the pitches above.
+    // if there are more than 128 pitches the lowest ones
+    // end up sharing slot 0.
+    int ceiling = MTS_slot_count - 1;
+    for (size_t k = buttons_count; k-- > 0;) {
+      if (slot[k] > ceiling) slot[k] = ceiling;
+      if (slot[k] < 0)       slot[k] = 0;
+      if (!shares[k]) ceiling = slot[k] - 1;
+    }
+    for (size_t k = 0; k < buttons_count; ++k) {
+      uint8_t b = order[k];
+      table[b] = slot[k];
+      set_slot(slot[k], MTS_frequency_word(note[b]));
+    }
+  }
+
+  void put_word(size_t& at, uint32_t w) {
+    buffer[at++] = (w >> 16) & 0x7F;
+    buffer[at++] = (w >> 8) & 0x7F;
+    buffer[at++] = w & 0x7F;
+  }
+
+  // non-real-time bulk tuning dump, all 128 slots
+  size_t build_bulk() {
+    size_t at = 0;
+    buffer[at++] = 0x7E;
+    buffer[at++] = MTS_device_all;
+    buffer[at++] = 0x08;
+    buffer[at++] = 0x01;
+    buffer[at++] = MTS_tuning_program;
+    const char name[MTS_name_length + 1] = "HexBoard layout ";
+    for (size_t c = 0; c < MTS_name_length; ++c) {
+      buffer[at++] = name[c];
+    }
+    for (size_t s = 0; s < MTS_slot_count; ++s) {
+      put_word(at, word[s]);
+    }
+    uint8_t checksum = 0;
+    for (size_t c = 0; c < at; ++c) {
+      checksum ^= buffer[c];
+    }
+    buffer[at++] = checksum & 0x7F;
+    return at;
+  }
+
+  // real-time single note tuning change, changed slots only
+  size_t build_single_note() {
+    size_t at = 0;
+    buffer[at++] = 0x7F;
+    buffer[at++] = MTS_device_all;
+    buffer[at++] = 0x08;
+    buffer[at++] = 0x02;
+    buffer[at++] = MTS_tuning_program;
+    size_t count_at = at++;
+    uint8_t count = 0;
+    for (size_t s = 0; (s < MTS_slot_count) && (count < MTS_single_max_keys); ++s) {
+      if (!changed[s]) continue;
+      buffer[at++] = s;
+      put_word(at, word[s]);
+      ++count;
+    }
+    buffer[count_at] = count;
+    return at;
+  }
+
+  // the shorter of the two messages that brings the synth
+  // up to date, or nullptr if nothing changed.
+  const uint8_t* message(size_t& message_length) {
+    size_t n = changed.count();
+    if (n == 0) {
+      message_length = 0;
+      return nullptr;
+    }
+    if ((n <= MTS_single_max_keys) && (MTS_single_header + 4 * n < MTS_bulk_length)) {
+      length = build_single_note();
+    } else {
+      length = build_bulk();
+    }
+    changed.reset();
+    message_length = length;
+    return buffer.data();
+  }
+};
+
+double MTS_word_to_pitch(uint32_t w) {
+  return ((w >> 16) & 0x7F) + ((((w >> 8) & 0x7F) << 7) | (w & 0x7F)) / 16384.0;
+}
+const uint32_t MTS_no_change = 0x7F7F7F;
+
+struct MTS_Received {
+  std::array<uint32_t, MTS_slot_count> word;
+
+  MTS_Received() {
+    for (size_t s = 0; s < MTS_slot_count; ++s) {
+      word[s] = s << 16;
+    }
+  }
+  uint32_t get_word(const uint8_t* at) const {
+    return ((uint32_t)at[0] << 16) | ((uint32_t)at[1] << 8) | at[2];
+  }
+  void put(size_t s, uint32_t w) {
+    if (w != MTS_no_change) word[s] = w;
+  }
+  double pitch(uint8_t note) const {
+    return MTS_word_to_pitch(word[note & 0x7F]);
+  }
+
+  // a SysEx as MIDI.h hands it over, F0 and F7 included.
+  // returns true if it was a tuning message we can use.
+  // the bulk checksum is not checked, as senders are
+  // known to disagree about what it covers.
+  bool receive(const uint8_t* msg, size_t len) {
+    if ((len < 2) || (msg[0] != 0xF0) || (msg[len - 1] != 0xF7)) return false;
+    ++msg;
+    len -= 2;
+    if ((len < 5) || (msg[2] != 0x08)) return false;
+    if ((msg[0] == 0x7E) && (msg[3] == 0x01)) {
+      if (len < MTS_bulk_length - 1) return false;
+      const uint8_t* at = msg + 5 + MTS_name_length;
+      for (size_t s = 0; s < MTS_slot_count; ++s, at += 3) {
+        put(s, get_word(at));
+      }
+      return true;
+    }
+    if ((msg[0] == 0x7F) && (msg[3] == 0x02)) {
+      if (len < MTS_single_header) return false;
+      size_t count = msg[5];
+      if (len < MTS_single_header + 4 * count) return false;
+      const uint8_t* at = msg + MTS_single_header;
+      for (size_t k = 0; k < count; ++k, at += 4) {
+        put(at[0] & 0x7F, get_word(at + 1));
+      }
+      return true;
+    }
+    return false;
+  }
+};
@@ -1,14 +1,16 @@
 #pragma once
 #include <stdint.h>
-#include <functional>
-#include <vector>
 #include <Wire.h>
 #include <U8g2lib.h>
 #include "pico/time.h"
 #include <string>
+#include <string_view>
+#include <array>
+#include "hardware/i2c.h"
 
 // Create an instance of the U8g2 graphics library.
 U8G2_SH1107_SEEED_128X128_F_HW_I2C u8g2(U8G2_R2);
+#include "OLED_DMA.h"
 
 const uint8_t _OLED_HEIGHT = 128;
 const uint8_t _OLED_WIDTH  = 128;
@@ -18,36 +20,236 @@ const uint8_t _SM_FONT_HEIGHT = 6;
 const uint8_t _LEFT_MARGIN = 6;
 const uint8_t _RIGHT_MARGIN = 8;
 
-void drawStringWrap(u8g2_uint_t x, u8g2_uint_t y, std::string str, bool altWrap = false) {
-  std::vector<std::string> linesOfText(0);
-  uint8_t yCursor = y;
-  int8_t yLineBreak = 2 + u8g2.getAscent() - u8g2.getDescent();
-  size_t strCursor = 0;
-  bool endOfString = false;
-  while ((yCursor <= _OLED_HEIGHT - yLineBreak) && (yCursor > 0)) {
-    if (endOfString) break;
-    std::string thisLine;
-    thisLine.clear();
-    bool endOfLine = false;
-    while (!endOfString && !endOfLine) {
-      if (str.substr(strCursor,1) == "\n") {
-        endOfLine = true;
-      } else {
-        thisLine += str[strCursor];
-        endOfLine = (u8g2.getStrWidth(thisLine.c_str()) > (_OLED_WIDTH - _RIGHT_MARGIN - x));
+/*
+ *  Wrapped text.
+ *
+ *  Widths come from a table per font, filled in from the
+ *  font's glyphs the first time it is used, so measuring a
+ *  line is adding up bytes. Where each line starts and ends
+ *  goes into a fixed array, and the last few layouts are
+ *  kept, keyed by the text (pointer, length and a hash of
+ *  the contents), the font and the width. A GUI layer that
+ *  draws the same text every frame therefore measures it
+ *  once, and nothing here allocates.
+ */
+
+const size_t  text_max_lines      = 16;   // 128 px / 8 px lines
+const size_t  text_max_line_chars = 64;   // 128 px / 2 px glyphs
+const size_t  text_layout_cache   = 8;
+const size_t  glyph_table_fonts   = 4;
+const uint8_t glyph_first         = 0x20;
+const uint8_t glyph_count         = 0x60; // the _tr fonts: space to DEL
+
+struct Glyph_Widths {
+  const uint8_t* font = nullptr;
+  std::array<uint8_t, glyph_count> width;
+};
+std::array<Glyph_Widths, glyph_table_fonts> glyph_widths;
+
+// widths for the font u8g2 is drawing with
+const Glyph_Widths& current_glyph_widths() {
+  const uint8_t* font = u8g2.getU8g2()->font;
+  for (auto& g : glyph_widths) {
+    if (g.font == font) return g;
+  }
+  Glyph_Widths* g = &glyph_widths[0];
+  for (auto& each : glyph_widths) {
+    if (each.font == nullptr) { g = &each; break; }
+  }
+  g->font = font;
+  for (uint8_t c = 0; c < glyph_count; ++c) {
+    int8_t w = u8g2_GetGlyphWidth(u8g2.getU8g2(), glyph_first + c);
+    g->width[c] = (w > 0 ? w : 0);
+  }
+  return *g;
+}
+uint8_t glyph_width(const Glyph_Widths& g, char c) {
+  uint8_t i = (uint8_t)c - glyph_first;
+  return (i < glyph_count ? g.width[i] : 0);
+}
+
+uint32_t text_hash(std::string_view str) {
+  uint32_t h = 2166136261u;  // FNV-1a
+  for (char c : str) {
+    h = (h ^ (uint8_t)c) * 16777619u;
+  }
+  return h;
+}
+
+struct Text_Layout {
+  const char*    text   = nullptr;
+  size_t         length = 0;
+  uint32_t       hash   = 0;
+  const uint8_t* font   = nullptr;
+  uint8_t        width  = 0;
+  uint8_t        lines  = 0;
+  std::array<uint16_t, text_max_lines> begin;
+  std::array<uint16_t, text_max_lines> end;
+
+  bool matches(std::string_view str, uint32_t h, const uint8_t* f, uint8_t w) const {
+    return (text == str.data()) && (length == str.size()) && (hash == h)
+        && (font == f) && (width == w);
+  }
+
+  // break at a newline, or before the character that would
+  // go past the width -- at the last space if there is one
+  void build(std::string_view str, const Glyph_Widths& g, uint8_t w) {
+    lines = 0;
+    size_t at = 0;
+    while ((at < str.size()) && (lines < text_max_lines)) {
+      size_t   line_end = at;
+      size_t   last_space = 0;
+      bool     has_space = false;
+      uint16_t px = 0;
+      while ((line_end < str.size()) && (str[line_end] != '\n')
+          && (line_end - at < text_max_line_chars)) {
+        uint8_t cw = glyph_width(g, str[line_end]);
+        if ((px + cw > w) && (line_end > at)) break;
+        if (str[line_end] == ' ') { last_space = line_end; has_space = true; }
+        px += cw;
+        ++line_end;
       }
-      endOfString = (++strCursor >= str.size());
+      size_t next = line_end;
+      bool wrapped = (line_end < str.size()) && (str[line_end] != '\n');
+      if (wrapped && (str[line_end] == ' ')) {
+        next = line_end + 1;  // the space that didn't fit
+      } else if (wrapped && has_space && (last_space > at)) {
+        line_end = last_space;
+        next = last_space + 1;
+      } else if (!wrapped && (line_end < str.size())) {
+        next = line_end + 1;  // past the newline
+      }
+      begin[lines] = at;
+      end[lines]   = line_end;
+      ++lines;
+      at = next;
     }
-    linesOfText.push_back(thisLine);
-    yCursor += yLineBreak * (altWrap ? -1 : 1); 
   }
-  for (size_t i = 0; i < linesOfText.size(); ++i) {
-    int j = i;
-    if (altWrap) j -= (linesOfText.size() - 1);
-    u8g2.drawStr(x, y + (j * yLineBreak), linesOfText[i].c_str());
+};
+std::array<Text_Layout, text_layout_cache> text_layouts;
+size_t text_layout_next = 0;
+
+const Text_Layout& layout_text(std::string_view str, uint8_t w) {
+  const Glyph_Widths& g = current_glyph_widths();
+  uint32_t h = text_hash(str);
+  for (auto& t : text_layouts) {
+    if (t.matches(str, h, g.font, w)) return t;
+  }
+  Text_Layout& t = text_layouts[text_layout_next];
+  text_layout_next = (text_layout_next + 1) % text_layout_cache;
+  t.text   = str.data();
+  t.length = str.size();
+  t.hash   = h;
+  t.font   = g.font;
+  t.width  = w;
+  t.build(str, g, w);
+  return t;
+}
+
+// altWrap: y is the baseline of the last line, and the
+// text grows upward from there
+void drawStringWrap(u8g2_uint_t x, u8g2_uint_t y, std::string_view str, bool altWrap = false) {
+  if (x >= _OLED_WIDTH - _RIGHT_MARGIN) return;
+  const Text_Layout& t = layout_text(str, _OLED_WIDTH - _RIGHT_MARGIN - x);
+  int yLineBreak = 2 + u8g2.getAscent() - u8g2.getDescent();
+  // as many lines as fit between y and the edge of the screen
+  int room = (altWrap ? (y + yLineBreak - 1) : (_OLED_HEIGHT - y)) / yLineBreak;
+  int count = (t.lines < room ? t.lines : room);
+  char line[text_max_line_chars + 1];
+  for (int k = 0; k < count; ++k) {
+    size_t b = t.begin[k];
+    size_t n = t.end[k] - b;
+    str.copy(line, n, b);
+    line[n] = '\0';
+    int row = (altWrap ? k - (count - 1) : k);
+    u8g2.drawStr(x, y + row * yLineBreak, line);
+  }
+}
+
+/*
+ *  Sending only what changed.
+ *
+ *  The SH1107 is written in pages: 16 strips of 8 pixel
+ *  rows, 128 bytes each. A copy of what is on the glass is
+ *  kept here. The menu library sends the whole buffer
+ *  after drawing, so while it draws the tile writes are
+ *  held back (the display callback is wrapped), and then
+ *  only the pages that differ from the copy go out, as
+ *  runs through updateDisplayArea.
+ *
+ *  OLED_Damage decides whether to draw at all: something
+ *  has to have marked the screen, a GUI layer changed, or
+ *  a timed element (the knob arrows) is still showing.
+ */
+
+const uint8_t OLED_pages_count = _OLED_HEIGHT / 8;
+const uint8_t OLED_page_bytes  = _OLED_WIDTH;
+
+struct OLED_Pages {
+  u8x8_msg_cb display_cb = nullptr;   // the real driver
+  bool        hold = false;
+  std::array<std::array<uint8_t, OLED_page_bytes>, OLED_pages_count> shown;
+  uint32_t    pages_sent = 0;
+
+  static uint8_t filter(u8x8_t* u8x8, uint8_t msg, uint8_t arg_int, void* arg_ptr);
+
+  // after u8g2.begin(), which leaves the screen blank
+  void hook(U8G2& u) {
+    for (auto& page : shown) page.fill(0);
+    display_cb = u.getU8x8()->display_cb;
+    u.getU8x8()->display_cb = filter;
+  }
+  bool page_changed(const uint8_t* buffer, uint8_t p) const {
+    return memcmp(buffer + p * OLED_page_bytes, shown[p].data(), OLED_page_bytes) != 0;
+  }
+  void flush(U8G2& u) {
+    const uint8_t* buffer = u.getBufferPtr();
+    uint8_t tiles_wide = u.getBufferTileWidth();
+    for (uint8_t p = 0; p < OLED_pages_count;) {
+      if (!page_changed(buffer, p)) { ++p; continue; }
+      uint8_t run = p;
+      while ((run < OLED_pages_count) && page_changed(buffer, run)) {
+        memcpy(shown[run].data(), buffer + run * OLED_page_bytes, OLED_page_bytes);
+        ++run;
+      }
+      u.updateDisplayArea(0, p, tiles_wide, run - p);
+      pages_sent += run - p;
+      p = run;
+    }
   }
+};
+OLED_Pages OLED_pages;
+
+uint8_t OLED_Pages::filter(u8x8_t* u8x8, uint8_t msg, uint8_t arg_int, void* arg_ptr) {
+  if (OLED_pages.hold && (msg == U8X8_MSG_DISPLAY_DRAW_TILE)) return 1;
+  return OLED_pages.display_cb(u8x8, msg, arg_int, arg_ptr);
 }
 
+struct OLED_Damage {
+  bool     dirty = true;
+  uint32_t busy_until = 0;
+
+  void mark() {
+    dirty = true;
+  }
+  // redraw every frame for a while, e.g. while an arrow shows
+  void mark_for(uint32_t now_uS, uint32_t uS) {
+    busy_until = now_uS + uS;
+    dirty = true;
+  }
+  bool due(bool layers_changed, uint32_t now_uS) {
+    if (layers_changed) dirty = true;
+    if ((int32_t)(busy_until - now_uS) > 0) {
+      dirty = true;   // one more frame after it ends
+      return true;
+    }
+    bool d = dirty;
+    dirty = false;
+    return d;
+  }
+};
+OLED_Damage OLED_damage;
+
 void connect_OLED_display(uint8_t SDA, uint8_t SCL) {
   // the microprocessor is the RP2040 / RP2350 series
   // and we use Earle Philhower's pico library to interface
@@ -61,6 +263,9 @@ void connect_OLED_display(uint8_t SDA, uint8_t SCL) {
   u8g2.setBusClock(1000000);
   u8g2.setContrast(255);
   u8g2.setFont(u8g2_font_6x12_tr);
+  OLED_pages.hook(u8g2);
+  // from here on frames go out by DMA; Wire is on i2c0
+  OLED_DMA.begin(u8g2, i2c0);
 }
 
 struct OLED_screensaver {
@@ -93,51 +298,94 @@ struct OLED_screensaver {
   }
 };
 
+/*
+ *  GUI layers.
+ *
+ *  Each bit of the context is a layer drawn over the menu:
+ *  a plain function, and a fixed slot of text it is given
+ *  to draw. Nothing is copied or allocated when drawing.
+ *  A layer is marked dirty when it is switched on or off,
+ *  its text changes, or something it shows has changed
+ *  (mark()); a frame where no layer is dirty and nothing
+ *  else marked the screen is not drawn at all.
+ */
+
 const size_t maximum_GUI_layers = 32;
+const size_t GUI_text_capacity  = 128;
+
+using GUI_Draw_Handler = void (*)(std::string_view);
+
+struct GUI_Text {
+  std::array<char, GUI_text_capacity> c;
+  uint8_t length = 0;
+
+  std::string_view view() const {
+    return std::string_view(c.data(), length);
+  }
+  // false if it already said that
+  bool assign(std::string_view s) {
+    if (s.size() > GUI_text_capacity) s = s.substr(0, GUI_text_capacity);
+    if (view() == s) return false;
+    s.copy(c.data(), s.size());
+    length = s.size();
+    return true;
+  }
+};
 
 struct GUI_Object {
-  size_t sz;
-  uint32_t last_updated;
+  std::array<GUI_Draw_Handler, maximum_GUI_layers> drawLayer;
+  std::array<GUI_Text, maximum_GUI_layers>         text;
   uint32_t context;
-  std::vector<std::function<void(std::string)>> drawLayer;
-  std::vector<std::string> strParam;
-  GUI_Object(size_t n) : 
-    sz(n),
-    drawLayer(n), 
-    strParam(n),
-    context(0),
-    last_updated(0) {}  
+  uint32_t dirty;
+  uint32_t last_updated;
+
+  GUI_Object() : context(0), dirty(0), last_updated(0) {
+    drawLayer.fill(nullptr);
+  }
+  void touch(uint32_t c) {
+    dirty |= c;
+    last_updated = timer_hw->timerawl;
+  }
   void add_context(uint32_t c) {
+    touch(c & ~context);
     context |= c;
-    last_updated = timer_hw->timerawl;
   }
   void remove_context(uint32_t c) {
+    touch(c & context);
     context &= ~c;
-    last_updated = timer_hw->timerawl;
   }
-  void set_context(uint32_t c, std::string s) {
+  void set_context(uint32_t c, std::string_view s) {
+    touch(c ^ context);
     context = c;
-    for (int i = 0; i < sz; ++i) {
-      if (context & (1u << i)) {
-        strParam[i] = s;
-      }
+    set_text(c, s);
+  }
+  void set_text(uint32_t c, std::string_view s) {
+    for (size_t i = 0; i < maximum_GUI_layers; ++i) {
+      if ((c & (1u << i)) && text[i].assign(s)) touch(1u << i);
     }
-    last_updated = timer_hw->timerawl;
   }
-  void set_handler(uint32_t c, std::function<void(std::string)> f) {
-    for (int i = 0; i < sz; ++i) {
-      if (c & (1u << i)) {
-        drawLayer[i] = f;
-      }
+  void set_handler(uint32_t c, GUI_Draw_Handler f) {
+    for (size_t i = 0; i < maximum_GUI_layers; ++i) {
+      if (c & (1u << i)) drawLayer[i] = f;
     }
-    last_updated = timer_hw->timerawl;
+    touch(c & context);
+  }
+  // what a showing layer draws has changed
+  void mark(uint32_t c) {
+    if (c & context) touch(c & context);
+  }
+  // the layers that changed since the last call
+  uint32_t take_dirty() {
+    uint32_t d = dirty;
+    dirty = 0;
+    return d;
   }
   void draw() {
-    for (size_t i = 0; i < sz; ++i) {
-      if (context & (1u << i)) {
-        drawLayer[i](strParam[i]);
+    for (size_t i = 0; i < maximum_GUI_layers; ++i) {
+      if ((context & (1u << i)) && (drawLayer[i] != nullptr)) {
+        drawLayer[i](text[i].view());
       }
     }
   }
 };
-GUI_Object GUI(maximum_GUI_layers);
\ No newline at end of file
+GUI_Object GUI;
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+#include <U8g2lib.h>
+#include "hardware/dma.h"
+#include "hardware/i2c.h"
+
+/*
+ *  OLED over I2C, sent by DMA.
+ *
+ *  u8g2's own I2C driver writes every byte and waits for
+ *  the bus, which holds up core0 for the whole transfer.
+ *  Instead, this byte callback turns each I2C transaction
+ *  u8g2 asks for into 16-bit words for the I2C block's
+ *  command register (data, plus STOP on the last byte) and
+ *  collects a whole frame. At the end of the frame a DMA
+ *  channel feeds the words to the I2C transmit FIFO in the
+ *  background.
+ *
+ *  There are two word buffers: one being sent, one being
+ *  filled. The next frame is drawn and queued while the
+ *  last one is still going out. Only if a frame is ready
+ *  before the last one has finished (which would take a
+ *  frame over 40 ms of I2C) does submit() wait.
+ *
+ *  Wire has already set up the I2C block, pins and clock
+ *  by the time this takes over, after u8g2.begin().
+ */
+
+const size_t OLED_DMA_words = 3072;   // a full frame plus commands
+
+struct OLED_DMA_Transport {
+  std::array<std::array<uint16_t, OLED_DMA_words>, 2> words;
+  size_t      count = 0;      // in the buffer being filled
+  uint8_t     filling = 0;
+  int         channel = -1;
+  i2c_inst_t* port = nullptr;
+  uint32_t    frames_sent = 0;
+
+  static uint8_t byte_cb(u8x8_t* u8x8, uint8_t msg, uint8_t arg_int, void* arg_ptr);
+
+  void begin(U8G2& u, i2c_inst_t* i2c) {
+    port = i2c;
+    channel = dma_claim_unused_channel(true);
+    i2c_hw_t* hw = i2c_get_hw(port);
+    hw->enable = 0;
+    hw->tar    = u8x8_GetI2CAddress(u.getU8x8()) >> 1;
+    hw->enable = 1;
+    u.getU8x8()->byte_cb = byte_cb;
+  }
+  bool busy() const {
+    return (channel >= 0) && dma_channel_is_busy(channel);
+  }
+  void put(uint16_t w) {
+    if (count == OLED_DMA_words) submit();
+    words[filling][count++] = w;
+  }
+  void stop() {
+    if (count) words[filling][count - 1] |= I2C_IC_DATA_CMD_STOP_BITS;
+  }
+
+  // start sending what was queued, and switch buffers
+  void submit() {
+    if (count == 0) return;
+    if (busy()) dma_channel_wait_for_finish_blocking(channel);
+    // a NAK stops the I2C block until the abort is cleared
+    (void)i2c_get_hw(port)->clr_tx_abrt;
+    dma_channel_config c = dma_channel_get_default_config(channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, i2c_get_dreq(port, true));
+    dma_channel_configure(channel, &c, &i2c_get_hw(port)->data_cmd,
+                          words[filling].data(), count, true);
+    ++frames_sent;
+    filling ^= 1;
+    count = 0;
+  }
+};
+OLED_DMA_Transport OLED_DMA;
+
+uint8_t OLED_DMA_Transport::byte_cb(u8x8_t* u8x8, uint8_t msg, uint8_t arg_int, void* arg_ptr) {
+  switch (msg) {
+    case U8X8_MSG_BYTE_SEND: {
+      const uint8_t* data = static_cast<const uint8_t*>(arg_ptr);
+      for (uint8_t k = 0; k < arg_int; ++k) {
+        OLED_DMA.put(data[k]);
+      }
+      break;
+    }
+    case U8X8_MSG_BYTE_END_TRANSFER:
+      OLED_DMA.stop();
+      break;
+    case U8X8_MSG_BYTE_INIT:
+    case U8X8_MSG_BYTE_SET_DC:
+    case U8X8_MSG_BYTE_START_TRANSFER:
+      break;
+    default:
+      return 0;
+  }
+  return 1;
+}
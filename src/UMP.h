@@ -0,0 +1,133 @@
+#pragma once
+#include <stdint.h>
+#include <cmath>
+#include <array>
+
+/*
+ *  MIDI 2.0 Universal MIDI Packets.
+ *
+ *  In _MIDImode_2_point_oh each note is a single 64-bit
+ *  packet: 16-bit velocity, and the exact microtonal pitch
+ *  as a "pitch 7.9" attribute, where MIDI 1.0 would need a
+ *  pitch bend and a note-on (or an MPE channel). Pressure
+ *  and other per-note controllers are 32 bits.
+ *
+ *  Packets are collected into a batch buffer and handed to
+ *  a sink in one go. The Arduino TinyUSB stack has no UMP
+ *  endpoint yet, so for now the sink (set in init_MIDI)
+ *  translates each packet to MIDI 1.0 as the spec's default
+ *  translation does: notes and poly pressure go out at 7
+ *  bits, the pitch attribute and per-note pitch bend and
+ *  controllers are dropped.
+ */
+
+const size_t  UMP_batch_words = 64;   // 32 notes' worth
+const uint8_t UMP_group       = 0;
+
+enum {
+  _UMP_type_MIDI2_voice = 0x4
+};
+enum {
+  _UMP_registered_per_note_ctrl = 0x0,
+  _UMP_assignable_per_note_ctrl = 0x1,
+  _UMP_per_note_pitch_bend      = 0x6,
+  _UMP_note_off                 = 0x8,
+  _UMP_note_on                  = 0x9,
+  _UMP_poly_pressure            = 0xA
+};
+enum {
+  _UMP_attr_none      = 0x00,
+  _UMP_attr_pitch_7_9 = 0x03
+};
+const uint32_t UMP_bend_center = 0x80000000;
+const double   UMP_per_note_bend_range = 48.0;  // semitones, the default
+
+// scale a 7-bit value up to 16 or 32 bits, as in the
+// MIDI 2.0 spec: 0 stays 0, the center stays the center,
+// and the top value fills all the bits.
+uint16_t UMP_upscale_16(uint8_t v) {
+  v &= 0x7F;
+  if (v <= 64) return v << 9;
+  uint8_t repeat = v & 0x3F;
+  return (v << 9) | (repeat << 3) | (repeat >> 3);
+}
+uint32_t UMP_upscale_32(uint8_t v) {
+  v &= 0x7F;
+  if (v <= 64) return (uint32_t)v << 25;
+  uint32_t repeat = v & 0x3F;
+  return ((uint32_t)v << 25) | (repeat << 19) | (repeat << 13) | (repeat << 7) | (repeat << 1) | (repeat >> 5);
+}
+
+// pitch 7.9: MIDI note number in the top 7 bits, then
+// 9 bits of fraction of a semitone
+uint16_t UMP_pitch_7_9(double midi_pitch) {
+  if (midi_pitch < 0.0) return 0;
+  long p = lround(midi_pitch * 512.0);
+  return (p > 0xFFFF ? 0xFFFF : p);
+}
+
+uint32_t UMP_voice_word(uint8_t status, uint8_t channel, uint8_t index, uint8_t attr) {
+  // channel is 1 - 16 in the rest of the app, 0 - 15 on the wire
+  return ((uint32_t)_UMP_type_MIDI2_voice << 28) | ((uint32_t)(UMP_group & 0xF) << 24)
+       | ((uint32_t)(status & 0xF) << 20) | ((uint32_t)((channel - 1) & 0xF) << 16)
+       | ((uint32_t)(index & 0x7F) << 8)  | attr;
+}
+
+// the MIDI 1.0 message for a 64-bit voice packet, if it
+// has one. the top 7 bits of the velocity or pressure are
+// kept; a note-on never comes out with velocity 0.
+bool UMP_to_MIDI_1(uint32_t w0, uint32_t w1, uint8_t& status, uint8_t& data1, uint8_t& data2) {
+  if ((w0 >> 28) != _UMP_type_MIDI2_voice) return false;
+  uint8_t type = (w0 >> 20) & 0xF;
+  switch (type) {
+    case _UMP_note_on: case _UMP_note_off: case _UMP_poly_pressure:
+      break;
+    default:
+      return false;
+  }
+  status = (type << 4) | ((w0 >> 16) & 0xF);
+  data1  = (w0 >> 8) & 0x7F;
+  data2  = w1 >> 25;
+  if ((type == _UMP_note_on) && (data2 == 0)) data2 = 1;
+  return true;
+}
+
+using UMP_Sink = void (*)(const uint32_t* words, size_t count);
+
+struct UMP_Batch {
+  std::array<uint32_t, UMP_batch_words> words;
+  size_t   count;
+  UMP_Sink sink;
+
+  UMP_Batch() : count(0), sink(nullptr) {}
+
+  void flush() {
+    if (count == 0) return;
+    if (sink != nullptr) sink(words.data(), count);
+    count = 0;
+  }
+  void put(uint32_t w0, uint32_t w1) {
+    if (count + 2 > UMP_batch_words) flush();
+    words[count++] = w0;
+    words[count++] = w1;
+  }
+
+  void note_on(uint8_t channel, uint8_t note, uint8_t velocity, uint16_t pitch_7_9) {
+    put(UMP_voice_word(_UMP_note_on, channel, note, _UMP_attr_pitch_7_9),
+        ((uint32_t)UMP_upscale_16(velocity) << 16) | pitch_7_9);
+  }
+  void note_off(uint8_t channel, uint8_t note, uint8_t velocity) {
+    put(UMP_voice_word(_UMP_note_off, channel, note, _UMP_attr_none),
+        (uint32_t)UMP_upscale_16(velocity) << 16);
+  }
+  void poly_pressure(uint8_t channel, uint8_t note, uint32_t pressure) {
+    put(UMP_voice_word(_UMP_poly_pressure, channel, note, 0), pressure);
+  }
+  void per_note_pitch_bend(uint8_t channel, uint8_t note, uint32_t bend) {
+    put(UMP_voice_word(_UMP_per_note_pitch_bend, channel, note, 0), bend);
+  }
+  void per_note_controller(uint8_t channel, uint8_t note, uint8_t controller, uint32_t value, bool registered) {
+    put(UMP_voice_word(registered ? _UMP_registered_per_note_ctrl : _UMP_assignable_per_note_ctrl,
+                       channel, note, controller), value);
+  }
+};
@@ -0,0 +1,173 @@
+#pragma once
+#include <stdint.h>
+#include <cstdlib>
+#include <array>
+#include <bitset>
+#include "config.h"
+#include "settings.h"
+#include "hexBoardGrid.h"
+#include "LED.h"
+
+/*
+ *  Animations triggered by key presses.
+ *
+ *  The links between neighbouring pixels, and how far
+ *  each key is from the farthest pixel, are worked out
+ *  once at boot. The rings of the splash modes are found
+ *  from the hex coordinates as they are drawn: a distance
+ *  is a few adds, cheaper than keeping a 140 x 140 table
+ *  in RAM. The number of animations running at once is
+ *  capped by a fixed pool, so the cost per frame does not
+ *  grow with the number of keys held down.
+ *
+ *  While a MIDI clock runs (master or slave) the orbit goes
+ *  round its key once a beat, from the tempo's beat phase;
+ *  otherwise one step per animation frame.
+ *
+ *  tests/host/animation_bench.cpp times a frame.
+ */
+
+const size_t   animation_pool_size = 40;
+const uint32_t no_beat = 0xFFFFFFFF;   // no clock running
+
+// distance between two hexes, in steps. x is doubled
+// so every diagonal step moves 1 in x and 1 in y.
+int hex_distance(const Hex& A, const Hex& B) {
+  int dx = std::abs(A.x - B.x);
+  int dy = std::abs(A.y - B.y);
+  return dy + (dx > dy ? (dx - dy) / 2 : 0);
+}
+
+struct Animation_Instance {
+  bool     active   = false;
+  bool     held     = false;
+  uint8_t  type     = _animType_none;
+  uint8_t  origin   = 0;    // pixel of the key that started it
+  uint32_t start_uS = 0;
+};
+
+struct Animation_Engine {
+  const Button_Grid& grid;
+  // the most steps from each pixel to any other
+  std::array<uint8_t, buttons_count> farthest;
+  // pixels that share a note / a pitch class light up together
+  // in the "by note" and "octave" modes. the layout fills these in.
+  std::array<int16_t, buttons_count> note_group;
+  std::array<int16_t, buttons_count> class_group;
+
+  std::array<Animation_Instance, animation_pool_size> pool;
+  std::bitset<buttons_count> lit;
+  std::bitset<buttons_count> lit_before;
+  uint32_t color;
+  uint64_t last_tick;
+  uint32_t beat;      // 0 - 2^24 through the beat, or no_beat
+
+  Animation_Engine(const Button_Grid& g) : grid(g), color(0xFFFFFF), last_tick(0), beat(no_beat) {
+    for (size_t p = 0; p < buttons_count; ++p) {
+      note_group[p]  = p;
+      class_group[p] = p;
+      farthest[p] = 0;
+      for (size_t q = 0; q < buttons_count; ++q) {
+        int dist = hex_distance(grid.coord[p], grid.coord[q]);
+        if (dist > farthest[p]) farthest[p] = dist;
+      }
+    }
+  }
+
+  void set_pitch_groups(size_t pxl, int16_t note, int16_t pitch_class) {
+    note_group[pxl]  = note;
+    class_group[pxl] = pitch_class;
+  }
+
+  void start(size_t pxl, int type, uint32_t now_uS) {
+    if (type == _animType_none) return;
+    // reuse a free slot, otherwise bump the oldest animation
+    Animation_Instance *slot = &pool[0];
+    for (auto& a : pool) {
+      if (!a.active) { slot = &a; break; }
+      if ((now_uS - a.start_uS) > (now_uS - slot->start_uS)) slot = &a;
+    }
+    slot->active   = true;
+    slot->held     = true;
+    slot->type     = type;
+    slot->origin   = pxl;
+    slot->start_uS = now_uS;
+  }
+
+  void release(size_t pxl) {
+    for (auto& a : pool) {
+      if (a.active && a.held && (a.origin == pxl)) a.held = false;
+    }
+  }
+
+  void light_ring(uint8_t origin, int r) {
+    if ((r < 0) || (r > farthest[origin])) return;
+    const Hex& o = grid.coord[origin];
+    for (size_t p = 0; p < buttons_count; ++p) {
+      if (hex_distance(o, grid.coord[p]) == r) lit.set(p);
+    }
+  }
+  void light_star(uint8_t origin, int r) {
+    if (r < 0) return;
+    for (size_t dir = 0; dir < 6; ++dir) {
+      uint8_t p = grid.along_ray(origin, dir, r);
+      if (p != no_button) lit.set(p);
+    }
+  }
+  void light_beams(uint8_t origin) {
+    for (size_t dir = 0; dir < 6; ++dir) {
+      for (uint8_t p = grid.neighbor[origin][dir]; p != no_button; p = grid.neighbor[p][dir]) {
+        lit.set(p);
+      }
+    }
+  }
+  void light_group(const std::array<int16_t, buttons_count>& group, uint8_t origin) {
+    for (size_t p = 0; p < buttons_count; ++p) {
+      if (group[p] == group[origin]) lit.set(p);
+    }
+  }
+
+  // returns false once the animation has run its course
+  bool draw(const Animation_Instance& a, uint32_t frame) {
+    int r = frame;
+    int R = farthest[a.origin];
+    switch (a.type) {
+      case _animType_star:           light_star(a.origin, r);         return (r <= R);
+      case _animType_splash:         light_ring(a.origin, r);         return (r <= R);
+      case _animType_star_reverse:   light_star(a.origin, R - r);     return (r <= R);
+      case _animType_splash_reverse: light_ring(a.origin, R - r);     return (r <= R);
+      case _animType_orbit: {
+        uint32_t step = (beat == no_beat ? frame % 6 : (beat * 6ull) >> 24);
+        uint8_t p = grid.neighbor[a.origin][step];
+        if (p != no_button) lit.set(p);
+        return a.held;
+      }
+      case _animType_beams:          light_beams(a.origin);           return a.held;
+      case _animType_octave:         light_group(class_group, a.origin); return a.held;
+      case _animType_by_note:        light_group(note_group, a.origin);  return a.held;
+      default:                                                        return false;
+    }
+  }
+
+  // called every LED frame. frames per second is expressed
+  // as frames per 2^20 microseconds. only redraws the
+  // animation layer when a new animation frame is due.
+  // beat_fraction is from Tempo_Engine, or no_beat.
+  void advance(uint32_t now_uS, int fps, LED_Compositor& LED, uint32_t beat_fraction = no_beat) {
+    uint64_t tick = ((uint64_t)now_uS * fps) >> 20;
+    if (tick == last_tick) return;
+    last_tick = tick;
+    beat = beat_fraction;
+    lit_before = lit;
+    lit.reset();
+    for (auto& a : pool) {
+      if (!a.active) continue;
+      uint32_t frame = ((uint64_t)(now_uS - a.start_uS) * fps) >> 20;
+      a.active = draw(a, frame);
+    }
+    for (size_t p = 0; p < buttons_count; ++p) {
+      if (lit[p] == lit_before[p]) continue;
+      LED.set_layer(_LED_layer_anim, p, (lit[p] ? color : 0));
+    }
+  }
+};
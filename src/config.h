@@ -83,6 +83,15 @@ const uint8_t LED_frame_rate_Hz = 60;
 const uint8_t OLED_frame_rate_Hz = 24;
 constexpr int32_t LED_poll_interval_mS = 1'000 / LED_frame_rate_Hz;
 constexpr int32_t OLED_poll_interval_mS = 1'000 / OLED_frame_rate_Hz;
+const uint8_t wheel_update_rate_Hz = 100;  // most MIDI / synth updates per wheel
+constexpr int32_t wheel_poll_interval_mS = 1'000 / wheel_update_rate_Hz;
+
+// NeoPixel current draw, used to keep the LEDs within
+// what the USB port can supply. a WS2812 channel draws
+// about 20mA at full duty, plus about 1mA per pixel idle.
+const uint16_t LED_channel_full_mA = 20;
+const uint16_t LED_idle_mA_per_pixel = 1;
+const uint16_t LED_current_budget_mA = 450;
 
 // TO-DO: test on hardware v2
 const uint16_t default_analog_calibration_up = 480;
@@ -101,9 +110,15 @@ constexpr uint16_t neutral_level = (1u << (audio_bits - 1)) - 1;
 const size_t buttons_count = 140;  // based on the size of the NeoPixel installed
 constexpr size_t hardwire_count = keys_count - buttons_count;
 
+// range of button coordinates in the table below
+const int hex_x_min = -11;
+const int hex_x_max =   9;
+const int hex_y_min =  -6;
+const int hex_y_max =   7;
+
 // physical coordinates & pin-out locations of each button
 // ordered by NeoStrip pixel number (0 thru 139 on this version)
-const int hexBoard_layout_hw_1_2[buttons_count][4] = {
+constexpr int hexBoard_layout_hw_1_2[buttons_count][4] = {
   // x   y    mux   col  pixel
   {-10,  0, 0b0000, 0}, //   0 ** "left side button"
   { -8, -6, 0b0000, 1}, //   1
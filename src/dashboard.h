@@ -0,0 +1,84 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+
+/*
+ *  Play mode dashboard.
+ *
+ *  With the menu closed the knob works one live parameter
+ *  at a time: turning changes it on the spot, a click moves
+ *  on to the next one in live_parameter_order. The dashboard
+ *  layer names the parameter and its value; the slider
+ *  layer shows a bar for each one, each on its own display
+ *  page, so a change sends only the page of the bar that
+ *  moved (see OLED_Pages).
+ *
+ *  The values themselves live where they always do
+ *  (settings, or the wheels) and are read and written
+ *  through get_live_value / set_live_value in main.
+ */
+
+enum {
+  _live_transpose,
+  _live_program,
+  _live_brightness,
+  _live_volume,
+  _live_mod,
+  _live_bend,
+  _live_count
+};
+
+struct Live_Parameter {
+  const char* name;
+  const char* label;  // beside its slider
+  int16_t     min;
+  int16_t     max;
+  int16_t     step;   // per knob detent
+};
+
+const std::array<Live_Parameter, _live_count> live_parameters = {{
+  {"Transpose",   "Trans", -127,  127,   1},
+  {"Program",     "Prog",     1,  128,   1},
+  {"Brightness",  "Light",    0,  255,   5},
+  {"Synth volume","Vol",      0,  127,   4},
+  {"Mod wheel",   "Mod",      0,  127,   4},
+  {"Pitch bend",  "Bend", -8192, 8191, 256},
+}};
+
+// which parameters the knob cycles through, and in what
+// order. leave some out to skip them.
+const uint8_t live_parameter_order[] = {
+  _live_transpose, _live_program, _live_brightness,
+  _live_volume,    _live_mod,     _live_bend
+};
+const size_t live_parameter_slots = sizeof(live_parameter_order) / sizeof(live_parameter_order[0]);
+
+const uint8_t slider_top    = 40;   // page 5
+const uint8_t slider_pitch  = 8;    // one page per bar
+const uint8_t slider_left   = 32;
+const uint8_t slider_width  = 88;
+const uint8_t slider_height = 5;
+
+struct Dashboard {
+  uint8_t position = 0;   // in live_parameter_order
+
+  uint8_t selected() const {
+    return live_parameter_order[position];
+  }
+  void next() {
+    position = (position + 1) % live_parameter_slots;
+  }
+  // the value after turning the knob by detents
+  static int32_t stepped(uint8_t p, int32_t value, int32_t detents) {
+    const Live_Parameter& lp = live_parameters[p];
+    int32_t v = value + detents * lp.step;
+    if (v < lp.min) v = lp.min;
+    if (v > lp.max) v = lp.max;
+    return v;
+  }
+  // 0 - slider_width
+  static uint8_t bar_length(uint8_t p, int32_t value) {
+    const Live_Parameter& lp = live_parameters[p];
+    return (uint32_t)(value - lp.min) * slider_width / (lp.max - lp.min);
+  }
+};
@@ -223,4 +223,22 @@ double frequency_after_pitch_bend(
        * exp2(ldexp(global_pitch_bend 
        * pitch_bend_range_in_semitones / 3.d, 
         -15));
-}
\ No newline at end of file
+}
+
+// the same pitch bend as a frequency ratio, in fixed point.
+// worked out once whenever the bend changes. a voice then
+// bends its precomputed DDS interval with one multiply.
+const int pitch_bend_ratio_bits = 16;
+const uint32_t no_pitch_bend = 1u << pitch_bend_ratio_bits;
+
+uint32_t pitch_bend_ratio(
+  int16_t global_pitch_bend, 
+  uint8_t pitch_bend_range_in_semitones) {
+  return lround(ldexp(frequency_after_pitch_bend(1.0, 
+    global_pitch_bend, pitch_bend_range_in_semitones), 
+    pitch_bend_ratio_bits));
+}
+
+uint32_t interval_after_pitch_bend(uint32_t interval, uint32_t ratio) {
+  return ((uint64_t)interval * ratio) >> pitch_bend_ratio_bits;
+}
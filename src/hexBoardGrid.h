@@ -1,6 +1,5 @@
 #pragma once
 #include <stdint.h>
-#include <map>
 #include <array>
 #include "config.h"
 
@@ -95,102 +94,144 @@ struct Hardwire_Switch {
   uint8_t state;
 };
 
-struct Physical_Button {
-  size_t   pixel;               // associated pixel
-  size_t   pinID;               // linear index of muxPin/colPin
-  Hex      coord;               // physical location
-  uint32_t timeLastUpdate = 0; // store time that key level was last updated
-  uint32_t timePressBegan = 0; // store time that full press occurred
-  uint32_t timeHeldSince  = 0;
-  uint8_t  pressure       = 0; // press level currently
-  uint8_t  velocity       = 0; // proxy for velocity
-  bool     just_pressed   = false;
-  bool     just_released  = false;
-  void     * pxl_data_ptr = nullptr; // pointer to pixel color data
-  void     * app_data_ptr = nullptr; // pointer to application data
-  void update_levels(uint32_t& timestamp, uint8_t& new_level) {
-    if (pressure == new_level) return;
-    timeLastUpdate = timestamp;
-    if (new_level == 0) {
-      just_released = true;
-      velocity = 0;
-      timeHeldSince = 0;
-    } else if (new_level >= 127) {
-      just_pressed = true;
-      velocity = 127;
-      // velocity = function of timeLastUpdate - timePressBegan;
-      // need a velocity curve, eventually. this is ignored in v1.2.
-      timePressBegan = 0;
-      timeHeldSince = timeLastUpdate;
-    } else if (timePressBegan == 0) {
-      timePressBegan = timeLastUpdate;
-    }
-    pressure = new_level;
-  }
+// coordinates are looked up in a flat table covering
+// the bounding box of the board, rather than a map.
+// each cell holds the button index, or no_button.
+constexpr int    coord_x_span = hex_x_max - hex_x_min + 1;
+constexpr int    coord_y_span = hex_y_max - hex_y_min + 1;
+constexpr size_t coord_table_size = coord_x_span * coord_y_span;
+const uint8_t    no_button = 0xFF;
 
-  bool check_and_reset_just_pressed() {
-    bool result = just_pressed;
-    just_pressed = false;
-    return result;
-  }
-  
-  bool check_and_reset_just_released() {
-    bool result = just_released;
-    just_released = false;
-    return result;
+// every button of a hardware layout has to sit inside the
+// coordinate table, or the grid couldn't find it
+constexpr bool layout_fits_coord_table(const int (&def)[buttons_count][4]) {
+  for (size_t i = 0; i < buttons_count; ++i) {
+    if ((def[i][0] < hex_x_min) || (def[i][0] > hex_x_max)) return false;
+    if ((def[i][1] < hex_y_min) || (def[i][1] > hex_y_max)) return false;
   }
+  return true;
+}
+static_assert(layout_fits_coord_table(hexBoard_layout_hw_1_2),
+  "a button in hexBoard_layout_hw_1_2 is outside the hex_x / hex_y range");
+static_assert(buttons_count < no_button, "button index must fit in uint8_t");
+static_assert(keys_count <= 0x100, "pin index must fit in uint8_t");
 
+// bit flags set when a key message comes in,
+// and cleared once the handler has seen them
+enum {
+  _btn_just_pressed  = 1u << 0,
+  _btn_just_released = 1u << 1
 };
 
+// the buttons are stored as parallel arrays indexed by
+// button number (which is also the pixel number), so a
+// pass over the whole grid reads contiguous memory and
+// only the fields it actually uses.
 struct Button_Grid {
-  std::array<Physical_Button, buttons_count>  btn;
+  // hardware defined, static
+  std::array<Hex,      buttons_count> coord;           // physical location
+  std::array<uint8_t,  buttons_count> pinID;           // linear index of muxPin/colPin
+  // updated on each key message
+  std::array<uint8_t,  buttons_count> pressure;        // press level currently
+  std::array<uint8_t,  buttons_count> velocity;        // proxy for velocity
+  std::array<uint8_t,  buttons_count> flags;           // _btn_just_pressed etc.
+  std::array<uint32_t, buttons_count> timeLastUpdate;  // time that key level was last updated
+  std::array<uint32_t, buttons_count> timePressBegan;  // time that partial press began
+  std::array<uint32_t, buttons_count> timeHeldSince;   // time that full press occurred
+
   std::array<Hardwire_Switch, hardwire_count> dip;
-  std::array<Physical_Button*, keys_count>    btn_at_index;
+  std::array<uint8_t, keys_count>             btn_at_index;
   std::array<Hardwire_Switch*, keys_count>    dip_at_index;
-  std::map<Hex, Physical_Button*>             btn_by_coord;
+  std::array<uint8_t, coord_table_size>       btn_index_at_coord;
+  // next button over in each of the six directions, or no_button.
+  // following these links from a button traces out a ray.
+  std::array<std::array<uint8_t, 6>, buttons_count> neighbor;
 
   Button_Grid(const int def[buttons_count][4]) {
-    for (auto& ptr : btn_at_index) {ptr = nullptr;}
+    btn_at_index.fill(no_button);
     for (auto& ptr : dip_at_index) {ptr = nullptr;}
+    btn_index_at_coord.fill(no_button);
+    pressure.fill(0);
+    velocity.fill(0);
+    flags.fill(0);
+    timeLastUpdate.fill(0);
+    timePressBegan.fill(0);
+    timeHeldSince.fill(0);
 
     for (size_t pxl = 0; pxl < buttons_count; ++pxl) {
       Hex x(def[pxl][0],def[pxl][1]);
       size_t i = linear_index(def[pxl][2], def[pxl][3]);
-      btn[pxl].pixel = pxl;
-      btn[pxl].pinID = i;
-      btn[pxl].coord = x;
-      btn_at_index[i] = &(btn[pxl]);
-      btn_by_coord[x] = &(btn[pxl]);
+      pinID[pxl] = i;
+      coord[pxl] = x;
+      btn_at_index[i] = pxl;
+      int slot = coord_slot(x);
+      if (slot >= 0) btn_index_at_coord[slot] = pxl;
+    }
+    for (size_t pxl = 0; pxl < buttons_count; ++pxl) {
+      for (size_t dir = 0; dir < 6; ++dir) {
+        neighbor[pxl][dir] = index_at(coord[pxl] + unitHex[dir]);
+      }
     }
     size_t h = 0;
     for (size_t k = 0; k < keys_count; ++k) {
-      if (btn_at_index[k] == nullptr) {
+      if (btn_at_index[k] == no_button) {
         dip[h].pinID = k;
         dip_at_index[k] = &(dip[h]);
         if (++h == hardwire_count) break;
       }
     }
   }
-  void* appData_at_index(size_t i) {
-    return btn_at_index[i]->app_data_ptr;
+
+  void update_levels(uint8_t i, uint32_t timestamp, uint8_t new_level) {
+    if (pressure[i] == new_level) return;
+    timeLastUpdate[i] = timestamp;
+    if (new_level == 0) {
+      flags[i] |= _btn_just_released;
+      velocity[i] = 0;
+      timeHeldSince[i] = 0;
+    } else if (new_level >= 127) {
+      flags[i] |= _btn_just_pressed;
+      velocity[i] = 127;
+      // velocity = function of timeLastUpdate - timePressBegan;
+      // need a velocity curve, eventually. this is ignored in v1.2.
+      timePressBegan[i] = 0;
+      timeHeldSince[i] = timestamp;
+    } else if (timePressBegan[i] == 0) {
+      timePressBegan[i] = timestamp;
+    }
+    pressure[i] = new_level;
+  }
+  bool check_and_reset(uint8_t i, uint8_t flag) {
+    bool result = flags[i] & flag;
+    flags[i] &= ~flag;
+    return result;
   }
-  void* pxlData_at_index(size_t i) {
-    return btn_at_index[i]->pxl_data_ptr;
+  bool check_and_reset_just_pressed(uint8_t i) {
+    return check_and_reset(i, _btn_just_pressed);
   }
-  bool in_bounds(const Hex& coord) {
-    return (btn_by_coord.find(coord) != btn_by_coord.end());
+  bool check_and_reset_just_released(uint8_t i) {
+    return check_and_reset(i, _btn_just_released);
   }
-  void* appData_at_coord(Hex h) {
-    if (in_bounds(h)) {
-      return btn_by_coord.find(h)->second->app_data_ptr;
-    }
-    return nullptr;
+
+  // position in btn_index_at_coord, or -1 if off the table
+  static int coord_slot(const Hex& h) {
+    if ((h.x < hex_x_min) || (h.x > hex_x_max)) return -1;
+    if ((h.y < hex_y_min) || (h.y > hex_y_max)) return -1;
+    return (h.y - hex_y_min) * coord_x_span + (h.x - hex_x_min);
   }
-  void* pxlData_at_coord(Hex h) {
-    if (in_bounds(h)) {   
-      return btn_by_coord.find(h)->second->pxl_data_ptr;
+  uint8_t index_at(const Hex& h) const {
+    int slot = coord_slot(h);
+    return (slot < 0 ? no_button : btn_index_at_coord[slot]);
+  }
+  bool in_bounds(const Hex& coord) const {
+    return (index_at(coord) != no_button);
+  }
+  // the button n steps away in one direction, or no_button
+  uint8_t along_ray(uint8_t i, size_t dir, int n) const {
+    for (int step = 0; (step < n) && (i != no_button); ++step) {
+      i = neighbor[i][dir];
     }
-    return nullptr;
+    return i;
   }
 
-};
\ No newline at end of file
+};
@@ -1,27 +1,60 @@
 #pragma once
 #include <stdint.h>
 #include <cmath>
+#include <array>
+#include <bitset>
+#include "config.h"
 
-struct App_Data {
+const uint16_t MPE_bend_center = 8192;
+const uint16_t MPE_bend_max    = 16383;
+
+// musical data for each button, stored as parallel
+// arrays indexed by button number like Button_Grid.
+struct Note_Table {
   // MIDI info
-  uint8_t channel;
-  uint8_t table;
-  double  note;
-  double  freq;    // in Hz, used for synth
-  uint8_t cmd;     // assigned command, based on enum, used for MIDI
-  uint8_t param;   // assigned parameter, based on enum, used for MIDI
-  int8_t  equave;  // used for scales / visualization, not used for JI lattice
-  int8_t  degree;  // used for scales / visualization, for 1-dimension
-  uint8_t midiChPlaying  = 0;  // what midi channel is there currrently a note-on
-  uint8_t synthChPlaying = 0;  // what synth channel is there currrently a note-on
-
-  void setFreq(double Hz) {
-    freq = Hz;
-    note = 69.0 + 12.0 * log2(Hz / 440.0);
+  std::array<uint8_t, buttons_count> channel;
+  std::array<uint8_t, buttons_count> table;
+  std::array<double,  buttons_count> note;
+  std::array<double,  buttons_count> freq;    // in Hz, used for synth
+  // worked out by the layout so note-on is table reads only
+  std::array<uint32_t, buttons_count> interval; // DDS phase increment
+  std::array<uint8_t,  buttons_count> gain;     // equal loudness, iso226()
+  std::array<uint16_t, buttons_count> bend;     // MPE pitch bend from table note, 14 bits
+  std::array<uint16_t, buttons_count> pitch_7_9; // exact pitch for MIDI 2.0 note-on
+  std::array<uint8_t, buttons_count> cmd;     // assigned command, based on enum, used for MIDI
+  std::array<uint8_t, buttons_count> param;   // assigned parameter, based on enum, used for MIDI
+  std::array<int8_t,  buttons_count> equave;  // used for scales / visualization, not used for JI lattice
+  std::array<int16_t, buttons_count> degree;  // used for scales / visualization, for 1-dimension
+  std::array<uint8_t, buttons_count> midiChPlaying;   // what midi channel is there currrently a note-on
+  std::array<uint8_t, buttons_count> synthChPlaying;  // what synth channel is there currrently a note-on
+  std::array<uint8_t, buttons_count> midiNotePlaying; // the note number sent, in case of a transpose since
+  std::array<uint16_t, buttons_count> pitchPlaying;   // and the exact pitch, as pitch_7_9
+
+  Note_Table() {
+    channel.fill(0);
+    table.fill(0);
+    note.fill(0.0);
+    freq.fill(0.0);
+    interval.fill(0);
+    gain.fill(0);
+    bend.fill(MPE_bend_center);
+    pitch_7_9.fill(0);
+    cmd.fill(0);
+    param.fill(0);
+    equave.fill(0);
+    degree.fill(0);
+    midiChPlaying.fill(0);
+    synthChPlaying.fill(0);
+    midiNotePlaying.fill(0);
+    pitchPlaying.fill(0);
+  }
+  void setFreq(uint8_t i, double Hz) {
+    freq[i] = Hz;
+    note[i] = 69.0 + 12.0 * log2(Hz / 440.0);
   }
-  void setPitch(double midi) {
-    note = midi;
-    freq = 440.0 * exp2((midi - 69.0) / 12.0);
+  void setPitch(uint8_t i, double midi) {
+    note[i] = midi;
+    freq[i] = 440.0 * exp2((midi - 69.0) / 12.0);
   }
 
 };
@@ -57,432 +90,312 @@ void load_layout(hexBoard_Setting_Array& refS, File& F) {
 
 
 
-// below is reference code until it gets reconnected
-
 /*
-template <typename T1, typename T2>
-void update_if_closer_to_zero(T1& LHS, const T2& RHS) {
-  if (std::abs(RHS) < std::abs(LHS)) {LHS = RHS;}
-}
+ *  Layout engine.
+ *
+ *  Works out the pitch and palette tier of every button
+ *  from the layout settings. It is split into passes so
+ *  that a setting change only redoes what depends on it:
+ *
+ *  - axes:  each button's position in A / B steps from
+ *           the anchor hex (divisions, done rarely)
+ *  - scale: each button's offset in cents from the anchor
+ *           pitch, its scale degree and palette tier
+ *  - pitch: anchor pitch + transpose + cached offset.
+ *           this is the only pass a transpose needs, and
+ *           it is an add and a multiply per button.
+ *
+ *  Only buttons whose tier or degree moved are passed on
+ *  to the palette and animation engine.
+ */
+#include "hexBoardGrid.h"
+#include "palette.h"
+#include "animation.h"
+#include "direct_digital_synthesis.h"
+#include "tuning.h"
+#include "UMP.h"
+#include "pico/time.h"
+
+// what a setting change forces the layout to redo.
+// each level also runs the passes below it.
+enum {
+  _relayout_none,
+  _relayout_pitch,
+  _relayout_scale,
+  _relayout_axes
+};
 
-// cache value of log(3/2) / log(2)
-const double perfectFifth = 0.5849625007211562;
-
-void generate_and_apply_EDO_layout(double octave, int EDO, int A_span, int B_span) {
-  int spanFifth = round(EDO * perfectFifth);
-  // for 13EDO and 18EDO it is preferable to round down
-  // to the "flatter" fifth and not up to the "sharper" fifth
-  if ((EDO == 13) || (EDO == 18)) { --spanFifth; }
-  int spanFourth = EDO - spanFifth;
-  int spanSharp  = 7 * spanFifth - 4 * EDO;
-  int spanMajor2 = 2 * spanFifth - EDO;
-  int spanMinor2 = spanMajor2 - spanSharp;
-  int spanMinor3 = spanFourth - spanMajor2;
-  for (auto& n : hexBoard.btn) {
-    if (!n.isBtn) continue;
-    if (!n.isNote) continue; // for now assuming cmd btns are unchanged
-    n.scaleDegree = A_span * n.A_steps + B_span * n.B_steps; 
-    n.midiPitch += n.scaleDegree * (octave / 100.0 / EDO);
-    // scale by octave
-    n.scaleEquave = 0;
-    while (n.scaleDegree < 0) {
-      --(n.scaleEquave);
-      n.scaleDegree += EDO;
-    }
-    while (n.scaleDegree >= EDO) {
-      ++(n.scaleEquave);
-      n.scaleDegree -= EDO;
-    }
-    if (EDO < 10) { // algorithm doesn't really work below 10 EDO
-      n.paletteNum = n.scaleDegree;
-    } else {
-      // the white keys are tier 0 (C D E F G A B)
-      // the black keys are tier 1 (C#, Db, etc.)
-      // in larger EDOs you get other tiers like:
-      // tier -1: E# B# Fb Cb if they're separate
-      // tier 2/-2 or larger for other microtonal steps
-      // the algorithm works by knowing how to spell
-      // D and E, then treating all C F G & A's like D
-      // and treating B like E. we are assuming the
-      // "key" is "C", so that C = zero steps.
-      
-      // G, A, and B are spelled the same as C, D, and E.
-      // so take the scale degree modulo the 5th.
-      int stepsForPalette = n.scaleDegree % spanFifth;
-            // C is spelled like D, but D is now going to be zero.
-            if (stepsForPalette >= spanMajor2) { stepsForPalette -= spanMajor2; }
-            // G is spelled like F.
-            if (stepsForPalette >= spanFourth ) { stepsForPalette -= spanMajor2; }
-            // F is spelled like D.
-            if (stepsForPalette >= spanMinor3 ) { stepsForPalette -= spanMinor3; }
-            // C, D, F, G, and A are white keys.
-            if (stepsForPalette == 0)                       { n.paletteNum =  0; }
-            // E and B are white keys.
-      else  if (stepsForPalette == spanMajor2)              { n.paletteNum =  0; }
-            // C#, D#, F#, G#, and A# are black keys.
-      else  if (stepsForPalette == spanSharp)               { n.paletteNum =  1; }
-            // Db, Eb, Gb, Ab, and Bb are black keys.
-      else  if (stepsForPalette == spanMinor2)              { n.paletteNum =  1; }
-            // E# and B# get a different color if needed.
-      else  if (stepsForPalette == spanMajor2 + spanSharp)  { n.paletteNum = -1; }
-            // Fb and Cb get a different color if needed.
-      else  if (stepsForPalette == spanMinor3 - spanSharp)  { n.paletteNum = -1; }
-      else {
-        // if the note isn't one of those, then find how many microtonal steps
-        // away it is from a white or black key (not from E#/Fb).
-        n.paletteNum = stepsForPalette;
-        update_if_closer_to_zero(n.paletteNum, stepsForPalette - spanMinor3);
-        update_if_closer_to_zero(n.paletteNum, stepsForPalette - spanMajor2);
-        update_if_closer_to_zero(n.paletteNum, stepsForPalette - spanMinor2);
-        update_if_closer_to_zero(n.paletteNum, stepsForPalette - spanSharp);
-        // then increase by one so that you start counting 
-        // at tier 2, 3, ... if sharp, or -2, -3, ... if flat.
-        // e.g. D^ is one microtonal step sharp of D, tier +2.
-        //      Dv is one microtonal step flat of D, tier -2.
-        //      Bb^^ is two microtonal steps sharp of Bb, tier 3.
-        n.paletteNum += (n.paletteNum > 0 ? 1 : -1);
-      }
-    }
+int relayout_level(int setting) {
+  switch (setting) {
+    case _anchorX: case _anchorY: case _axisA: case _axisB:
+      return _relayout_axes;
+    case _anchorN: case _anchorC: case _anchorF:
+    case _txposeS: case _txposeC: case _MPEpb:
+      return _relayout_pitch;
+    case _equaveD: case _equaveC: case _tuneSys:
+    case _eqDivs:  case _eqStepA: case _eqStepB: case _eqScale: case _eqChrom:
+    case _lgSteps: case _smSteps: case _lgStepA: case _smStepA: case _lgStepB: case _smStepB:
+    case _lgToSmOp:case _lgToSmND:case _lgToSmR: case _lgToSmN: case _lgToSmD: case _modeLgSm:
+    case _JInumA:  case _JIdenA:  case _JInumB:  case _JIdenB:
+      return _relayout_scale;
+    default:
+      return _relayout_none;
   }
 }
 
+// the anchor pitch setting is split into a MIDI note,
+// coarse cents (-99 to +99, with -100 meaning "-0")
+// and fine hundredths of a cent.
+double anchor_pitch(hexBoard_Setting_Array& refS) {
+  int coarse = refS[_anchorC].i;
+  int fine   = (coarse < 0 ? -refS[_anchorF].i : refS[_anchorF].i);
+  if (coarse == -100) coarse = 0;
+  return refS[_anchorN].i + (coarse + fine / 100.0) / 100.0;
+}
 
-// recursive formula to generate MOS scale from large/small steps
-// outputs a vector of booleans
-// large step = TRUE/1   small step = FALSE/0
-#include <vector>
-#include <map>
+struct Layout_Engine {
+  const Button_Grid& grid;
+  Note_Table&        music;
+  Palette_Rings&     palette;
+  Animation_Engine&  animation;
+  // axes pass, steps along axis A / B from the anchor
+  std::array<int16_t, buttons_count> A_steps;
+  std::array<int16_t, buttons_count> B_steps;
+  // scale pass
+  std::array<double,  buttons_count> cents;  // offset from the anchor pitch
+  std::array<double,  buttons_count> ratio;  // same, as a frequency ratio
+  std::array<int8_t,  buttons_count> tier;
+  std::array<uint8_t, buttons_count> hue;    // position in the equave, 0 - 255
+  std::array<int16_t, buttons_count> pitch_class;
+  std::array<int16_t, buttons_count> pitch_step;
+  std::bitset<buttons_count>         recolor;
+  std::array<Monzo,   buttons_count> monzo;  // JI ratio to the anchor
+  int      pending;
+  bool     valid;
+  uint32_t last_relayout_uS;
+  uint32_t worst_relayout_uS;
+
+  Layout_Engine(const Button_Grid& g, Note_Table& n, Palette_Rings& p, Animation_Engine& a)
+  : grid(g), music(n), palette(p), animation(a)
+  , pending(_relayout_axes), valid(false)
+  , last_relayout_uS(0), worst_relayout_uS(0) {
+    A_steps.fill(0);
+    B_steps.fill(0);
+    cents.fill(0.0);
+    ratio.fill(1.0);
+    tier.fill(0);
+    hue.fill(0);
+    pitch_class.fill(0);
+    pitch_step.fill(0);
+    recolor.set();
+  }
 
-uint gcd(const uint& _a, const uint& _b) {
-  for (uint _f = _a - 1; _f > 1; --_f) {
-    if (!((_a % _f) || (_b % _f))) {
-      return _f;
+  // returns false if the anchor or axes don't make a layout
+  bool axes_pass(hexBoard_Setting_Array& refS) {
+    Hex anchor(refS[_anchorX].i, refS[_anchorY].i);
+    if (!grid.in_bounds(anchor)) {
+      return false; // 1) anchor hex must be valid -- in range and not a Cmd
+    }
+    if ((refS[_axisA].i < 0) || (refS[_axisA].i > 5)) return false;
+    if ((refS[_axisB].i < 0) || (refS[_axisB].i > 5)) return false;
+    Hex hexA = unitHex[refS[_axisA].i];
+    Hex hexB = unitHex[refS[_axisB].i];
+    if ((hexA == hexB) || (hexA == hexB * -1)) {
+      return false; // 2) axes cannot be parallel
+    }
+    for (size_t i = 0; i < buttons_count; ++i) {
+      axial_Hex h(grid.coord[i] - anchor, hexA, hexB);
+      A_steps[i] = h.a;
+      B_steps[i] = h.b;
     }
+    return true;
   }
-  return 1;
-}
 
-struct MOS_Scale {
-  std::vector<bool> steps;
-  // inMode[Mode #][Lg steps][Sm steps]
-  std::vector<std::vector<std::vector<bool>>> inMode;
-  std::vector<std::vector<bool>> inMode_EDO_equiv;
-  uint Lg;
-  uint Sm;
-  uint K; // GCD
-  uint G; // bright generator
-  uint modeCt;
-  bool rational;
-  uint underlyingEDO;
-
-  float ratio_f;
-  uint ratio_num_s;
-  uint ratio_den_L;
-
-  void determine_G_and_K() {
-    K = gcd(Lg,Sm);
-    G = 0;
-    for (uint8_t m = 1; m < (Lg + Sm); ++m) {
-      if ((Sm * m) % (Lg + Sm) == 1) {
-        G = m;
-        break;
-      }
-    }
-    modeCt = (Lg + Sm) / K;
+  void set_scale(uint8_t i, double c, int t, int degree, int equave, int steps_per_equave) {
+    cents[i] = c;
+    ratio[i] = exp2(c / 1200.0);
+    int8_t  new_tier = t;
+    uint8_t new_hue  = (steps_per_equave > 0 ? (256 * degree) / steps_per_equave : 0);
+    if ((tier[i] != new_tier) || (hue[i] != new_hue)) recolor.set(i);
+    if ((pitch_class[i] != degree) || (music.equave[i] != equave)) recolor.set(i);
+    tier[i] = new_tier;
+    hue[i]  = new_hue;
+    music.degree[i] = degree;
+    music.equave[i] = equave;
+    pitch_class[i]  = degree;
+    pitch_step[i]   = degree + equave * steps_per_equave;
   }
 
-  std::vector<bool> recursively_generate_MOS_scale(uint8_t L, uint8_t S) {
-    std::vector<bool> result;
-    if ((L == 1) || (S == 1)) {
-      for (uint8_t i = 0; i < L; ++i) {
-        result.emplace_back(true);
-      }
-      for (uint8_t i = 0; i < S; ++i) {
-        result.emplace_back(false);
-      }
-      return result;
-    } else {
-      int K = gcd(L,S);
-      if (K > 1) {
-        result = recursively_generate_MOS_scale(L/K, S/K);
-        std::vector<bool> repeatKtimes;
-        for (uint8_t i = 0; i < K; ++i) {
-          for (uint8_t j = 0; j < result.size(); ++j) {
-            repeatKtimes.emplace_back(result[j]);
-          }
-        }
-        return repeatKtimes;
-      } else {
-        uint8_t Mn = (L < S ? L : S);
-        uint8_t Mx = (L > S ? L : S);
-        uint8_t z = Mx % Mn;
-        uint8_t w = Mn - z;
-        uint8_t v = Mx / Mn; // floor, integer division
-        std::vector<bool> preScale = recursively_generate_MOS_scale(z, w);
-        if (L < S) {
-          std::reverse(preScale.begin(), preScale.end());
-          for (uint8_t i = 0; i < preScale.size(); ++i) {
-            result.emplace_back(true);
-            for (uint8_t j = 0; j < v + preScale[i]; ++j) {
-              result.emplace_back(false);
-            }
-          }
-        } else {
-          for (uint8_t i = 0; i < preScale.size(); ++i) {
-            for (uint8_t j = 0; j < v + preScale[i]; ++j) {
-              result.emplace_back(true);
-            }
-            result.emplace_back(false);
-          }
-        }
-      }
+  void EDO_pass(double equave_cents, int EDO, int A_span, int B_span) {
+    EDO_Spelling spelling(EDO);
+    for (size_t i = 0; i < buttons_count; ++i) {
+      int steps  = A_span * A_steps[i] + B_span * B_steps[i];
+      int equave = floor_div(steps, EDO);
+      int degree = steps - equave * EDO;
+      set_scale(i, steps * equave_cents / EDO, spelling.tier(degree), degree, equave, EDO);
     }
-    return result;
   }
 
-  MOS_Scale(int argL, int argS) : Lg(argL), Sm(argS) {
-    determine_G_and_K();
-    steps = recursively_generate_MOS_scale(Lg,Sm);
+  // just intonation. each button's ratio to the anchor is
+  // kept exactly, as a monzo, and only converted to cents
+  // (once per relayout) at the end, so there is no error
+  // built up across the lattice. notes are colored by
+  // prime limit and grouped by cents within the equave.
+  void JI_pass(double equave_cents, const Monzo& A, const Monzo& B) {
+    const int classes = lround(equave_cents);
+    for (size_t i = 0; i < buttons_count; ++i) {
+      monzo[i] = A * A_steps[i] + B * B_steps[i];
+      double c   = monzo[i].cents();
+      int equave = floor(c / equave_cents + 1e-9);
+      int degree = lround(c - equave * equave_cents) % classes;
+      set_scale(i, c, JI_tier(monzo[i].limit()), degree, equave, classes);
+    }
   }
 
-  void set_L_S_ratio(float r) {
-    rational = false;
-    ratio_f = r;
-    underlyingEDO = 0;
+  // large / small step counts along each axis
+  void MOS_steps(uint8_t i, hexBoard_Setting_Array& refS, int& lg, int& sm) {
+    lg = refS[_lgStepA].i * A_steps[i] + refS[_lgStepB].i * B_steps[i];
+    sm = refS[_smStepA].i * A_steps[i] + refS[_smStepB].i * B_steps[i];
   }
 
-  void set_L_S_ratio(uint n_s, uint d_l) {
-    rational = true;
-    ratio_num_s = n_s;
-    ratio_den_L = d_l;
-    ratio_f = (float)n_s / (float)d_l;
-    underlyingEDO = Sm * d_l + Lg * n_s;
-    inMode_EDO_equiv.resize(modeCt, 
-      std::vector<bool>(underlyingEDO, false));
+  // rational large : small ratio, every note is a degree of an EDO
+  void MOS_EDO_pass(double equave_cents, const MOS_in_EDO& map, hexBoard_Setting_Array& refS) {
+    for (size_t i = 0; i < buttons_count; ++i) {
+      int lg, sm;
+      MOS_steps(i, refS, lg, sm);
+      int steps  = map.degree(lg, sm);
+      int equave = floor_div(steps, map.EDO);
+      int degree = steps - equave * map.EDO;
+      set_scale(i, steps * equave_cents / map.EDO, map.tier(degree), degree, equave, map.EDO);
+    }
   }
 
-  std::vector<bool> get_mode(int mode) {
-    std::vector<bool> result;
-    for (uint8_t i = 0; i < (Lg + Sm); ++i) {
-      result.emplace_back(steps[(i + (G * mode)) % (Lg + Sm)]);
-    }
-    return result;
-  }  
-
-  void determine_key_colors() {
-    // initialize vector
-    inMode.resize(modeCt,
-      std::vector<std::vector<bool>>(Lg + 1,
-        std::vector<bool>(Sm + 1, false)
-    ));
-    int iL; // iterate # lg steps
-    int iS; // iterate # sm steps
-    for (uint8_t m = 0; m < modeCt; ++m) {
-      // traverse each mode of this scale
-      std::vector<bool> thisMode = get_mode(m);
-      iL = 0;
-      iS = 0;
-      for (uint8_t i = 0; i < Lg + Sm; ++i) {
-        // traverse each step in this mode
-        // and mark it TRUE
-        inMode[m][iL][iS] = true;
-        if (rational) {
-          inMode_EDO_equiv[m][iL * ratio_num_s + iS * ratio_den_L] = true;
-        }
-        iL +=  thisMode[i];
-        iS += !thisMode[i];
-      }
+  // irrational ratio, equave = (# large steps) * L + (# small steps) * S
+  void MOS_pass(double equave_cents, const MOS_Scale& mos, double L_to_S, hexBoard_Setting_Array& refS) {
+    double smCents = equave_cents / (mos.Lg * L_to_S + mos.Sm);
+    double lgCents = smCents * L_to_S;
+    const int classes = lround(equave_cents);
+    int mode = refS[_modeLgSm].i;
+    for (size_t i = 0; i < buttons_count; ++i) {
+      int lg, sm;
+      MOS_steps(i, refS, lg, sm);
+      double c   = lg * lgCents + sm * smCents;
+      int equave = floor(c / equave_cents + 1e-9);
+      int degree = lround(c - equave * equave_cents) % classes;
+      int t = mos.tier(mode, lg - equave * mos.Lg, sm - equave * mos.Sm);
+      set_scale(i, c, t, degree, equave, classes);
     }
   }
 
-};
-
-
-
-void apply_MOS_layout ( Hex    A_span, // X = lg, Y = sm
-                        Hex    B_span, // X = lg, Y = sm
-                        const  MOS_Scale& _mos,
-                        double period, int _mode) {
-  float smCents = period / _mos.Lg * _mos.ratio_f + _mos.Sm;
-  float lgCents = smCents * _mos.ratio_f;
-  for (auto& n : hexBoard.btn) {
-    if (!n.isBtn) continue;
-    if (!n.isNote) continue; // for now assuming cmd btns are unchanged
-    n.smallDegree = A_span.y * n.A_steps + B_span.y * n.B_steps;
-    n.largeDegree = A_span.x * n.A_steps + B_span.x * n.B_steps;
-    n.scaleEquave = 0;
-    if (_mos.rational) {
-      n.scaleDegree = n.largeDegree * _mos.ratio_num_s
-                    + n.smallDegree * _mos.ratio_den_L;
-      while (n.scaleDegree < 0) {
-        --n.scaleEquave;
-        n.smallDegree += _mos.Sm;
-        n.largeDegree += _mos.Lg;
-        n.scaleDegree += _mos.underlyingEDO;
-      }
-      while (n.scaleDegree >= _mos.underlyingEDO) {
-        ++n.scaleEquave;
-        n.smallDegree -= _mos.Sm;
-        n.largeDegree -= _mos.Lg;
-        n.scaleDegree -= _mos.underlyingEDO;
-      }
-      n.paletteNum = -1;
-      if (_mos.inMode_EDO_equiv[_mode][n.scaleDegree]) {
-        n.paletteNum = 0; // white key
-      } else {
-        for (uint i = 0; i < _mos.modeCt; ++i) {
-          if (_mos.inMode_EDO_equiv[(_mode + i) % _mos.modeCt][n.scaleDegree]) {
-            n.paletteNum = 1;
-          }
-        }
-      }
-    } else {
-      while ((n.smallDegree < 0) || (n.largeDegree < 0)) {
-        --n.scaleEquave;
-        n.smallDegree += _mos.Sm;
-        n.largeDegree += _mos.Lg;
+  bool scale_pass(hexBoard_Setting_Array& refS) {
+    double equave_cents = refS[_equaveC].d;
+    // 3) equave must be valid: the JI and MOS passes count
+    // pitch classes as whole cents, so at least one
+    if (equave_cents < 1.0) {
+      return false;
+    }
+    switch (refS[_tuneSys].i) {
+      case _tuneSys_normal: {
+        EDO_pass(1200.0, 12, refS[_eqStepA].i, refS[_eqStepB].i);
+        break;
       }
-      while ((n.smallDegree >= _mos.Sm) && (n.largeDegree >= _mos.Lg)) {
-        ++n.scaleEquave;
-        n.smallDegree -= _mos.Sm;
-        n.largeDegree -= _mos.Lg;
+      case _tuneSys_equal: {
+        if (refS[_eqDivs].i <= 0) return false;
+        EDO_pass(equave_cents, refS[_eqDivs].i, refS[_eqStepA].i, refS[_eqStepB].i);
+        break;
       }
-      n.paletteNum = -1;
-      if ((n.largeDegree <= _mos.Lg) && (n.smallDegree <= _mos.Sm)) {
-        if (_mos.inMode[_mode][n.largeDegree][n.smallDegree]) {
-          n.paletteNum = 0;
+      case _tuneSys_lg_sm: {
+        MOS_Scale mos(refS[_lgSteps].i, refS[_smSteps].i);
+        if (!mos.valid()) return false;
+        if (refS[_lgToSmND].b) {
+          MOS_in_EDO map(mos, refS[_modeLgSm].i, refS[_lgToSmN].i, refS[_lgToSmD].i);
+          if (!map.valid()) return false;
+          MOS_EDO_pass(equave_cents, map, refS);
         } else {
-          for (uint i = 0; i < _mos.modeCt; ++i) {
-            if (_mos.inMode[(_mode + i) % _mos.modeCt][n.largeDegree][n.smallDegree]) {
-              n.paletteNum = 1;
-            }
-          }
+          if (!(refS[_lgToSmR].d > 0.0)) return false;
+          MOS_pass(equave_cents, mos, refS[_lgToSmR].d, refS);
         }
+        break;
       }
+      case _tuneSys_just: {
+        Monzo A(refS[_JInumA].i, refS[_JIdenA].i);
+        Monzo B(refS[_JInumB].i, refS[_JIdenB].i);
+        if (!A.exact || !B.exact) return false;
+        JI_pass(equave_cents, A, B);
+        break;
+      }
+      default:
+        return false;
     }
-    n.midiPitch += period * n.scaleEquave / 100.0;
-    n.midiPitch += (smCents * n.smallDegree + lgCents * n.largeDegree) / 100.0;
+    return true;
   }
-}
 
-#include "color.h"
-
-bool generate_layout(hexBoard_Setting_Array& refS) {
-  Hex anchorHex(refS[_anchorX].i, refS[_anchorY].i);
-  if (!hexBoard.in_bounds(anchorHex)) {
-    return false; // 1) anchor hex must be valid -- in range and not a Cmd
-  }
-  Hex hexA = unitHex[refS[_axisA].i];
-  Hex hexB = unitHex[refS[_axisB].i];
-  if ((hexA == hexB) || (hexA == hexB * -1)) {
-    return false; // 2) axes cannot be parallel
-  }
-  // express the root pitch as MIDI (note + cents/100)
-  double anchorPitch = (double)refS[_anchorN].i + refS[_anchorC].d / 100.0;  
-  if (refS[_equaveC].d <= 0.0) {
-    return false; // 3) equave must be valid
-  }
-  for (auto& n : hexBoard.btn) {
-    // cache the number of A and B steps for each button
-    // relative to anchor hex
-    Hex h = n.coord - anchorHex;
-    if ((hexA == unitHex[dir_e]) || (hexA == unitHex[dir_w])) {
-      n.B_steps  =  h.y                       / hexB.y;
-      n.A_steps  = (h.x - n.B_steps * hexB.x) / hexA.x;
-    } else if ((hexB == unitHex[dir_e]) || (hexB == unitHex[dir_w])) {
-      n.A_steps  =  h.y                       / hexA.y;
-      n.B_steps  = (h.x - n.A_steps * hexA.x) / hexB.x;
-    } else {
-      n.A_steps  =  h.x                           / hexA.x;
-      n.B_steps  = (h.y - n.A_steps * hexA.y) / 2 / hexB.y;
-      n.A_steps += (h.y - n.A_steps * hexA.y) / 2 / hexA.y;
-    }
-    // preload anchor pitch
-    n.midiPitch = anchorPitch;
-  }    
-  // run the next steps based on what tuning system we're in
-  switch (refS[_tuneSys].i) {
-    case _tuneSys_normal: {
-      generate_and_apply_EDO_layout(1200.0, 12, 
-        refS[_eqStepA].i, refS[_eqStepB].i);
-      break;
-    }
-    case _tuneSys_equal: {
-      generate_and_apply_EDO_layout(refS[_equaveC].d, refS[_eqDivs].i, 
-        refS[_eqStepA].i, refS[_eqStepB].i);
-      break;
-    }
-    case _tuneSys_lg_sm: {
-      Hex A_axis(refS[_lgStepA].i, refS[_smStepA].i);
-      Hex B_axis(refS[_lgStepB].i, refS[_smStepB].i);
-      MOS_Scale MOS(refS[_lgSteps].i, refS[_smSteps].i);
-      if (refS[_lgToSmND].b) {
-        MOS.set_L_S_ratio(refS[_lgToSmN].i, refS[_lgToSmD].i);
-      } else {
-        MOS.set_L_S_ratio(refS[_lgToSmR].d);
-      }
-      MOS.determine_key_colors();
-      apply_MOS_layout(A_axis, B_axis, MOS, refS[_equaveC].d, refS[_modeLgSm].i);
-      break;
-    }
-    case _tuneSys_just: {
-      float JIcentsA = intervalToCents((float)refS[_JInumA].i / (float)refS[_JIdenA].i);
-      float JIcentsB = intervalToCents((float)refS[_JInumB].i / (float)refS[_JIdenB].i);
-      for (auto& n : hexBoard.btn) {
-        if (!n.isBtn) continue;
-        if (!n.isNote) continue; // for now assuming cmd btns are unchanged
-        n.midiPitch += JIcentsA * n.A_steps / 100.0;
-        n.midiPitch += JIcentsB * n.B_steps / 100.0;
-        n.paletteNum = 0;
-      }
-      break;
+  // anchor pitch plus transpose, applied to the cached
+  // offsets. no logarithms or exponents per button.
+  // everything a note-on needs (DDS interval, loudness,
+  // MIDI note, MPE bend) is worked out here, once.
+  void pitch_pass(hexBoard_Setting_Array& refS) {
+    double base = anchor_pitch(refS) + refS[_txposeS].i * refS[_txposeC].d / 100.0;
+    double base_freq = 440.0 * exp2((base - 69.0) / 12.0);
+    double bend_per_semitone = (refS[_MPEpb].i > 0 ? MPE_bend_center / (double)refS[_MPEpb].i : 0.0);
+    for (size_t i = 0; i < buttons_count; ++i) {
+      double n = base + cents[i] / 100.0;
+      long   m = lround(n);
+      if (m < 0)   m = 0;
+      if (m > 127) m = 127;
+      long   b = MPE_bend_center + lround((n - m) * bend_per_semitone);
+      music.note[i]     = n;
+      music.freq[i]     = base_freq * ratio[i];
+      music.table[i]    = m;
+      music.channel[i]  = 1;
+      music.interval[i] = frequency_to_interval(music.freq[i], audio_sample_interval_uS);
+      music.gain[i]     = iso226(music.freq[i]);
+      music.bend[i]     = (b < 0 ? 0 : (b > MPE_bend_max ? MPE_bend_max : b));
+      music.pitch_7_9[i] = UMP_pitch_7_9(n);
     }
   }
-  for (auto& n : hexBoard.btn) {
-    n.frequency = MIDItoFreq(n.midiPitch);
-    HSV paletteColor;
-    switch (n.paletteNum) {
-      case 0: {
-        paletteColor.h = 0.0;
-        paletteColor.s = 0.0;
-        paletteColor.v = 1.0;
-        break; 
-      } // white key
-      case 1: {
-        paletteColor.h = 270.0;
-        paletteColor.s = 1.0;
-        paletteColor.v = 0.5;
-        break;
-      } // black key
-      case -1: {
-        paletteColor.h = 45.0;
-        paletteColor.s = 1.0;
-        paletteColor.v = 0.5; 
-        break; 
-      } // E#/Fb
-      default: {
-        paletteColor.h = 144.0 + 36.0 * n.paletteNum;
-        paletteColor.s = 0.5;
-        paletteColor.v = 0.5;
-        break;
-      }
+
+  void color_pass() {
+    for (size_t i = 0; i < buttons_count; ++i) {
+      if (!recolor[i]) continue;
+      palette.assign(i, tier[i], hue[i] / 256.f);
+      animation.set_pitch_groups(i, pitch_step[i], pitch_class[i]);
     }
-    paletteColor.v *= refS[_globlBrt].i / 255.0;
-    n.LEDcodeBase = okhsv_to_neopixel_code(paletteColor);
+    recolor.reset();
   }
-  // reflect transposition in frequencies
 
-  // if MTS mode
-  // enumerate all the calculated pitches
-  // sort ascending, create MTS tuning table
-  // assign MIDI note based on this
-
-  // if not MTS mode
-  // MIDI note is round midiPitch
-  // calculate MPE pitch bend and store it
+  void request(int level) {
+    if (level > pending) pending = level;
+  }
 
-  // note coloring, this might take a while
+  // run whatever passes are pending. returns false if
+  // the settings don't make a valid layout, in which case
+  // the last good layout stays in place.
+  bool update(hexBoard_Setting_Array& refS) {
+    if (pending == _relayout_none) return valid;
+    uint32_t began = timer_hw->timerawl;
+    int level = pending;
+    pending = _relayout_none;
+    valid = true;
+    if (level >= _relayout_axes)  valid = axes_pass(refS);
+    if (valid && (level >= _relayout_scale)) valid = scale_pass(refS);
+    if (valid) {
+      pitch_pass(refS);
+      color_pass();
+    } else {
+      pending = level; // try again on the next change
+    }
+    last_relayout_uS = timer_hw->timerawl - began;
+    if (last_relayout_uS > worst_relayout_uS) worst_relayout_uS = last_relayout_uS;
+    return valid;
+  }
 
-  return true;
-}
-*/
\ No newline at end of file
+  // true if a setting affected the layout
+  bool on_setting_change(hexBoard_Setting_Array& refS, int setting) {
+    int level = relayout_level(setting);
+    if (level == _relayout_none) return false;
+    request(level);
+    update(refS);
+    return true;
+  }
+};
@@ -4,6 +4,8 @@
 #include <GEM_u8g2.h>   // library of code to create menu objects on the B&W display
 #include "config/enable-advanced-mode.h"
 #include "settings.h"
+#include <new>
+#include <utility>
 
 // pre-allocate an array for menu items that are
 // generated to modify settings.
@@ -195,7 +197,7 @@ GEMItem *menuItem[_settingSize];
  */
 
 struct GEMPagePublic : public GEMPage {
-	std::string header_text;
+	std::string_view header_text;
   GEMAppearance derived_appearance;
   void initialize_appearance(byte vOffset_, byte itemsPerScr_, byte hOffset_) {
     derived_appearance = {GEM_POINTER_ROW, itemsPerScr_, 
@@ -207,7 +209,7 @@ struct GEMPagePublic : public GEMPage {
     _appearance = &derived_appearance;
   }
   GEMPagePublic(const char* title_, 
-                std::string header_text_, byte headerRows_, 
+                std::string_view header_text_, byte headerRows_, 
                 byte itemsPerScreen_, byte valueMargin_)
   : GEMPage(title_), header_text(header_text_) {
     initialize_appearance(headerRows_, itemsPerScreen_, valueMargin_);
@@ -218,7 +220,7 @@ struct GEMPagePublic : public GEMPage {
     initialize_appearance(0, itemsPerScreen_, valueMargin_);
   }
   GEMPagePublic(const char* title_, void (*on_exit_)(),
-                std::string header_text_, byte headerRows_, 
+                std::string_view header_text_, byte headerRows_, 
 	              byte itemsPerScreen_, byte valueMargin_)
   : GEMPage(title_, on_exit_), header_text(header_text_) {
     initialize_appearance(headerRows_, itemsPerScreen_, valueMargin_);
@@ -267,18 +269,74 @@ void onChg(GEMCallbackData callbackData) {
   menu.drawMenu();
 }
 
-#define __LIB_LIST(L,P,A,E) menuItem[A]=new GEMItem(L,settings[A].i,*new GEMSelect(sizeof(E)/sizeof(E[0]),static_cast<SelectOptionInt*>(static_cast<void*>(E))),onChg,A);P.addMenuItem(*menuItem[A])
-#define __DROPDOWN(L,P,A,S) menuItem[A]=new GEMItem(L,settings[A].i,S,onChg,A);P.addMenuItem(*menuItem[A])
-#define __CHECKBOX(L,P,A) menuItem[A]=new GEMItem(L,settings[A].b,onChg,A);P.addMenuItem(*menuItem[A])
-#define __EDIT_FLT(L,P,A) menuItem[A]=new GEMItem(L,settings[A].d,onChg,A);P.addMenuItem(*menuItem[A])
-#define __SEND_INT(L,P,C) P.addMenuItem(*new GEMItem(L,onChg,C))
-#define __NAVIGATE(L,P,D) P.addMenuItem(*new GEMItem(L,D))
+/*
+ *  The menu tree is a constant table of entries, one per
+ *  menu item, and nothing is allocated for it on the heap.
+ *  At boot build_menu() makes each GEMItem (and the GEMSelect
+ *  of each library list) in place, in fixed arenas sized at
+ *  compile time from menu_entries[]: one item per entry, one
+ *  list per library list entry. Labels are constant too; a
+ *  label worked out at run time can't go in the table.
+ */
 
-void build_menu() {
+enum : uint8_t {
+  _menu_navigate,   // go to another page
+  _menu_command,    // send a trigger code to menu_handler
+  // the rest edit settings[code]
+  _menu_select,
+  _menu_spinner,
+  _menu_checkbox,
+  _menu_float,
+  _menu_list        // a GEMSelect made from a library list
+};
+
+struct Menu_Entry {
+  uint8_t     kind;
+  const char* label;
+  GEMPage*    page;
+  int         code;        // the setting, or the trigger
+  GEMPage*    to;
+  GEMSelect*  select;
+  GEMSpinner* spinner;
+  void*       options;     // SelectOptionInt[] for a list
+  uint8_t     option_count;
+};
+
+constexpr Menu_Entry menu_navigate(const char* L, GEMPage& P, GEMPage& D) {
+  return {_menu_navigate, L, &P, 0, &D, nullptr, nullptr, nullptr, 0};
+}
+constexpr Menu_Entry menu_command(const char* L, GEMPage& P, int C) {
+  return {_menu_command, L, &P, C, nullptr, nullptr, nullptr, nullptr, 0};
+}
+constexpr Menu_Entry menu_dropdown(const char* L, GEMPage& P, int A, GEMSelect& S) {
+  return {_menu_select, L, &P, A, nullptr, &S, nullptr, nullptr, 0};
+}
+constexpr Menu_Entry menu_dropdown(const char* L, GEMPage& P, int A, GEMSpinner& S) {
+  return {_menu_spinner, L, &P, A, nullptr, nullptr, &S, nullptr, 0};
+}
+constexpr Menu_Entry menu_checkbox(const char* L, GEMPage& P, int A) {
+  return {_menu_checkbox, L, &P, A, nullptr, nullptr, nullptr, nullptr, 0};
+}
+constexpr Menu_Entry menu_edit_float(const char* L, GEMPage& P, int A) {
+  return {_menu_float, L, &P, A, nullptr, nullptr, nullptr, nullptr, 0};
+}
+template <class T, size_t N>
+constexpr Menu_Entry menu_lib_list(const char* L, GEMPage& P, int A, T (&E)[N]) {
+  return {_menu_list, L, &P, A, nullptr, nullptr, nullptr, E, N};
+}
+
+#define __LIB_LIST(L,P,A,E) menu_lib_list(L,P,A,E)
+#define __DROPDOWN(L,P,A,S) menu_dropdown(L,P,A,S)
+#define __CHECKBOX(L,P,A)   menu_checkbox(L,P,A)
+#define __EDIT_FLT(L,P,A)   menu_edit_float(L,P,A)
+#define __SEND_INT(L,P,C)   menu_command(L,P,C)
+#define __NAVIGATE(L,P,D)   menu_navigate(L,P,D)
+
+constexpr Menu_Entry menu_entries[] = {
 
   // pgFileSystemError
-  __SEND_INT("Yes", pgFileSystemError, _trigger_format_flash - 1);
-  __SEND_INT("No",  pgFileSystemError, _trigger_format_flash);
+  __SEND_INT("Yes", pgFileSystemError, _trigger_format_flash - 1),
+  __SEND_INT("No",  pgFileSystemError, _trigger_format_flash),
 
   // pgSafeMode
   
@@ -288,44 +346,110 @@ void build_menu() {
 
   // sidebar pages
 /*
-  __EDIT_FLT("Amount in c",         pgSideBarCents, _equaveC);
-  __SEND_INT( "           Confirm", pgSideBarCents, _on_change_equave); // this needs work
-  fill_MIDI_pitch_names(string_array_MIDI_pitch_names, list_of_MIDI_pitch_names, 0, 7);
-  fill_coarse_pitch_values(string_array_coarse_pitch, list_of_coarse_pitch, 4, 3);
-  fill_fine_pitch_values(string_array_fine_pitch, list_of_fine_pitch, 7, 0);
-  __LIB_LIST("Pitch",    pgSideBarKey,   _anchorN,  list_of_MIDI_pitch_names);
-  __LIB_LIST("Coarse",   pgSideBarKey,   _anchorC,  list_of_coarse_pitch);
-  __LIB_LIST("Fine",     pgSideBarKey,   _anchorF,  list_of_fine_pitch);
-  __SEND_INT("           Confirm", pgSideBarKey, _on_change_key); // this needs work
+  __EDIT_FLT("Amount in c",         pgSideBarCents, _equaveC),
+  __SEND_INT( "           Confirm", pgSideBarCents, _on_change_equave), // this needs work
+  __LIB_LIST("Pitch",    pgSideBarKey,   _anchorN,  list_of_MIDI_pitch_names),
+  __LIB_LIST("Coarse",   pgSideBarKey,   _anchorC,  list_of_coarse_pitch),
+  __LIB_LIST("Fine",     pgSideBarKey,   _anchorF,  list_of_fine_pitch),
+  __SEND_INT("           Confirm", pgSideBarKey, _on_change_key), // this needs work
 
 
 
   // safe mode
-  __NAVIGATE("Hardware Test", pgSafeMode, pgHardwareTest);
-  __NAVIGATE("Show me a popup", pgSafeMode, pgShowMsg);
-    __SEND_INT("OK", pgShowMsg, -16);
-  __NAVIGATE("Show me a choice", pgSafeMode, pgShowMsg2);
-    __SEND_INT("OK", pgShowMsg2, -17);
-    __NAVIGATE("Cancel", pgShowMsg2, pgSafeMode);
-  //__NAVIGATE("Format Flash", pgSafeMode, pgFormatFlash);
+  __NAVIGATE("Hardware Test", pgSafeMode, pgHardwareTest),
+  __NAVIGATE("Show me a popup", pgSafeMode, pgShowMsg),
+    __SEND_INT("OK", pgShowMsg, -16),
+  __NAVIGATE("Show me a choice", pgSafeMode, pgShowMsg2),
+    __SEND_INT("OK", pgShowMsg2, -17),
+    __NAVIGATE("Cancel", pgShowMsg2, pgSafeMode),
+  //__NAVIGATE("Format Flash", pgSafeMode, pgFormatFlash),
 
   // menu tree
-  //__NAVIGATE("Tuning", pgHome, pgTuning);
-  __NAVIGATE("Layout", pgHome, pgLayout);
-  //__NAVIGATE("Scales", pgHome, pgScales);
-  //__NAVIGATE("Color Options", pgHome, pgColors);
-  //__NAVIGATE("Synth", pgHome, pgSynth);
-  //__NAVIGATE("MIDI Options", pgHome, pgMIDI);
-  //__NAVIGATE("Control Wheel", pgHome, pgControl);
-  //__NAVIGATE("Advanced", pgHome, pgAdvanced);
-  //	__NAVIGATE("Select from preset",  pgLayout,   pgL_preset);
-  //  __NAVIGATE("Make new isomorphic", pgLayout,   pgL_Iso);
-  //  __NAVIGATE("Make new easy-scale", pgLayout,   pgL_EZ);
-  //  __NAVIGATE("Make new microtonal", pgLayout,   pgL_Micro);
-  //    __DROPDOWN(" Period is:",          pgL_Micro,  _equaveD,  dd_periods);
-  //    __SEND_INT(label_anchor.c_str(),   pgL_Micro,  _goto_select_key);
+  //__NAVIGATE("Tuning", pgHome, pgTuning),
+  __NAVIGATE("Layout", pgHome, pgLayout),
+  //__NAVIGATE("Scales", pgHome, pgScales),
+  //__NAVIGATE("Color Options", pgHome, pgColors),
+  //__NAVIGATE("Synth", pgHome, pgSynth),
+  //__NAVIGATE("MIDI Options", pgHome, pgMIDI),
+  //__NAVIGATE("Control Wheel", pgHome, pgControl),
+  //__NAVIGATE("Advanced", pgHome, pgAdvanced),
+  //	__NAVIGATE("Select from preset",  pgLayout,   pgL_preset),
+  //  __NAVIGATE("Make new isomorphic", pgLayout,   pgL_Iso),
+  //  __NAVIGATE("Make new easy-scale", pgLayout,   pgL_EZ),
+  //  __NAVIGATE("Make new microtonal", pgLayout,   pgL_Micro),
+  //    __DROPDOWN(" Period is:",          pgL_Micro,  _equaveD,  dd_periods),
+  //    __SEND_INT("Anchor note",          pgL_Micro,  _goto_select_key),  // was label_anchor, built at run time
 
 */
+};
+
+// the arenas hold exactly what the table makes: one item
+// per entry, and one list per library list (at least one,
+// as a zero-length array isn't allowed).
+constexpr size_t menu_entry_count = sizeof(menu_entries) / sizeof(menu_entries[0]);
+
+constexpr size_t count_menu_entries(uint8_t kind) {
+  size_t n = 0;
+  for (const Menu_Entry& e : menu_entries) n += (e.kind == kind);
+  return n;
+}
+constexpr size_t count_menu_entries_made() {
+  size_t n = 0;
+  for (uint8_t kind = _menu_navigate; kind <= _menu_list; ++kind) n += count_menu_entries(kind);
+  return n;
+}
+static_assert(count_menu_entries_made() == menu_entry_count,
+  "a menu entry has a kind make_menu_item() doesn't know");
+
+const size_t menu_item_capacity = menu_entry_count;
+const size_t menu_list_capacity = (count_menu_entries(_menu_list) ? count_menu_entries(_menu_list) : 1);
+
+// objects made in place, once, and never freed
+template <class T, size_t N>
+struct Menu_Arena {
+  alignas(T) uint8_t storage[N][sizeof(T)];
+  size_t used = 0;
+
+  template <class... Args>
+  T* make(Args&&... args) {
+    if (used == N) return nullptr;
+    return new (storage[used++]) T(std::forward<Args>(args)...);
+  }
+};
+Menu_Arena<GEMItem,   menu_item_capacity> menu_item_arena;
+Menu_Arena<GEMSelect, menu_list_capacity> menu_list_arena;
+
+GEMItem* make_menu_item(const Menu_Entry& e) {
+  switch (e.kind) {
+    case _menu_navigate:
+      return menu_item_arena.make(e.label, *e.to);
+    case _menu_command:
+      return menu_item_arena.make(e.label, onChg, e.code);
+    case _menu_select:
+      return menu_item_arena.make(e.label, settings[e.code].i, *e.select, onChg, e.code);
+    case _menu_spinner:
+      return menu_item_arena.make(e.label, settings[e.code].i, *e.spinner, onChg, e.code);
+    case _menu_checkbox:
+      return menu_item_arena.make(e.label, settings[e.code].b, onChg, e.code);
+    case _menu_float:
+      return menu_item_arena.make(e.label, settings[e.code].d, onChg, e.code);
+    case _menu_list: {
+      GEMSelect* list = menu_list_arena.make(e.option_count, static_cast<SelectOptionInt*>(e.options));
+      if (list == nullptr) return nullptr;
+      return menu_item_arena.make(e.label, settings[e.code].i, *list, onChg, e.code);
+    }
+    default:
+      return nullptr;
+  }
+}
+
+void build_menu() {
+  for (const Menu_Entry& e : menu_entries) {
+    GEMItem* item = make_menu_item(e);
+    if (item == nullptr) continue;
+    if (e.kind >= _menu_select) menuItem[e.code] = item;
+    e.page->addMenuItem(*item);
+  }
 }
 
 struct GEMItemPublic : public GEMItem {
@@ -342,12 +466,16 @@ int menu_app_state() {
 
 void after_menu_update_GUI() {
 	GEMPagePublic* thisPg = static_cast<GEMPagePublic*>(menu.getCurrentMenuPage());
-  drawStringWrap(_LEFT_MARGIN, 4 + _SM_FONT_HEIGHT, thisPg->header_text.c_str());
+  drawStringWrap(_LEFT_MARGIN, 4 + _SM_FONT_HEIGHT, thisPg->header_text);
 	GUI.draw();
 }
 
 void menu_setup() {
   menu.setSplashDelay(0);
+  // library lists are filled in before their items are made
+  //fill_MIDI_pitch_names(string_array_MIDI_pitch_names, list_of_MIDI_pitch_names, 0, 7);
+  //fill_coarse_pitch_values(string_array_coarse_pitch, list_of_coarse_pitch, 4, 3);
+  //fill_fine_pitch_values(string_array_fine_pitch, list_of_fine_pitch, 7, 0);
   build_menu();
   menu.init();
   menu.setMenuPageCurrent(pgNoMenu);
@@ -0,0 +1,115 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+#include "config.h"
+#include "settings.h"
+#include "color_conversion.h"
+#include "LED.h"
+
+/*
+ *  Key colors.
+ *
+ *  Every key belongs to a palette tier (0 = white keys,
+ *  1 = black keys, -1 = E#/Fb, +/-2 and +/-3 = microtonal
+ *  steps away from those). Each tier's hue / sat / val is
+ *  a setting. Rather than convert every key's color through
+ *  OKHSV, each tier has a ring of colors going once around
+ *  the hue circle, worked out when the palette changes.
+ *  Cycling the hues (_hueLoop) is then just a rotating
+ *  index into the ring.
+ */
+
+const size_t hue_ring_steps = 64;  // power of 2
+const size_t palette_tier_count = 7;
+const size_t rainbow_row = palette_tier_count;
+const size_t palette_row_count = palette_tier_count + 1;
+
+// tiers 0, 1, -1, 2, -2, 3, -3 map to slots 0 thru 6,
+// in the same order as the _hue_0 ... _val_n3 settings.
+size_t palette_slot(int tier) {
+  if (tier >  3) tier =  3;
+  if (tier < -3) tier = -3;
+  return (tier > 0 ? 2 * tier - 1 : -2 * tier);
+}
+
+struct Palette_Rings {
+  std::array<std::array<uint32_t, hue_ring_steps>, palette_row_count> rest;
+  std::array<std::array<uint32_t, hue_ring_steps>, palette_row_count> play;
+  std::array<uint8_t, buttons_count> slot;   // palette tier of each pixel
+  std::array<uint8_t, buttons_count> start;  // position around the ring, for rainbow mode
+  int      mode;
+  uint32_t loop_uS;     // microseconds for 360 degrees, 0 = don't cycle
+  uint32_t offset;
+  bool     stale;
+
+  Palette_Rings() : mode(_palette_rainbow), loop_uS(0), offset(0), stale(true) {
+    slot.fill(0);
+    start.fill(0);
+  }
+
+  void build_row(size_t row, float hue, float sat, float val) {
+    for (size_t i = 0; i < hue_ring_steps; ++i) {
+      float h = hue + (360.f * i) / hue_ring_steps;
+      rest[row][i] = okhsv_to_neopixel_code({h, sat, val});
+      // pressed keys are lighter and less saturated
+      play[row][i] = okhsv_to_neopixel_code({h, sat * 0.5f, 1.f});
+    }
+    stale = true;
+  }
+  void build_tier(hexBoard_Setting_Array& refS, size_t s) {
+    size_t i = _hue_0 + 3 * s;
+    build_row(s, refS[i].d, refS[i + 1].d, refS[i + 2].d);
+    if (s == 0) {
+      build_row(rainbow_row, refS[_hue_0].d, 1.f, refS[_val_0].d);
+    }
+  }
+  void build_all(hexBoard_Setting_Array& refS) {
+    for (size_t s = 0; s < palette_tier_count; ++s) {
+      build_tier(refS, s);
+    }
+  }
+  // rebuild only the tier whose hue/sat/val setting changed
+  void on_color_setting(hexBoard_Setting_Array& refS, int setting) {
+    if ((setting < _hue_0) || (setting > _val_n3)) return;
+    build_tier(refS, (setting - _hue_0) / 3);
+  }
+
+  void set_mode(int palette) {
+    if (mode == palette) return;
+    mode = palette;
+    stale = true;
+  }
+  void set_loop(double seconds) {
+    loop_uS = (seconds > 0.0 ? seconds * 1'000'000.0 : 0);
+  }
+  // called by the layout when it works out each key's tier.
+  // position is the fraction of the way around the equave, 0 - 1.
+  void assign(size_t pxl, int tier, float position) {
+    slot[pxl]  = palette_slot(tier);
+    start[pxl] = (uint32_t)(position * hue_ring_steps + 0.5f) & (hue_ring_steps - 1);
+    stale = true;
+  }
+
+  // called every LED frame. only touches the LED layers
+  // when the ring has rotated or the colors were rebuilt.
+  void advance(uint32_t now_uS, LED_Compositor& LED) {
+    uint32_t new_offset = 0;
+    if (loop_uS) {
+      new_offset = ((uint64_t)now_uS * hue_ring_steps / loop_uS) & (hue_ring_steps - 1);
+    }
+    if (!stale && (new_offset == offset)) return;
+    offset = new_offset;
+    stale = false;
+    for (size_t p = 0; p < buttons_count; ++p) {
+      size_t row  = slot[p]; // tiered and alternate both go by tier
+      size_t step = offset;
+      if (mode == _palette_rainbow) {
+        row   = rainbow_row;
+        step += start[p];
+      }
+      step &= (hue_ring_steps - 1);
+      LED.set_layer(_LED_layer_base, p, rest[row][step]);
+      LED.set_layer(_LED_layer_play, p, play[row][step]);
+    }
+  }
+};
@@ -41,6 +41,8 @@ enum {
   _MIDIorMT,_MIDIpc,  _MT32pc,
   _synthTyp,_synthWav,_synthEnv, //
   _synthVol,_synthBuz,_synthJac, //
+  _clockMode,_tempoBPM,          // appended, so older settings files still load
+  _pbRange,
   _settingSize // the largest index plus one 
 };
 
@@ -91,6 +93,12 @@ enum {
   _synthTyp_poly
 };
 
+enum {
+  _clockMode_off,
+  _clockMode_master,
+  _clockMode_slave
+};
+
 enum {
   _GM_instruments,
   _MT32_instruments
@@ -179,6 +187,27 @@ void load_factory_defaults_to(hexBoard_Setting_Array& refS, int version = 0) {
   refS[_animType].i = 0;
   refS[_globlBrt].i = (version >= 12 ? _globlBrt_dim : _globlBrt_mid);
   refS[_hueLoop].d  = 30.0;  // seconds for 360 degrees 
+  refS[_hue_0].d    = 0.0;   // tier 0, white keys
+  refS[_sat_0].d    = 0.0;
+  refS[_val_0].d    = 0.75;
+  refS[_hue_1].d    = 270.0; // tier 1, black keys
+  refS[_sat_1].d    = 1.0;
+  refS[_val_1].d    = 0.5;
+  refS[_hue_n1].d   = 45.0;  // tier -1, E#/Fb
+  refS[_sat_n1].d   = 1.0;
+  refS[_val_n1].d   = 0.5;
+  refS[_hue_2].d    = 216.0; // tiers +/-2 and +/-3, microtonal steps
+  refS[_sat_2].d    = 0.5;
+  refS[_val_2].d    = 0.5;
+  refS[_hue_n2].d   = 72.0;
+  refS[_sat_n2].d   = 0.5;
+  refS[_val_n2].d   = 0.5;
+  refS[_hue_3].d    = 252.0;
+  refS[_sat_3].d    = 0.5;
+  refS[_val_3].d    = 0.5;
+  refS[_hue_n3].d   = 36.0;
+  refS[_sat_n3].d   = 0.5;
+  refS[_val_n3].d   = 0.5;
   refS[_tglWheel].b = false; // bool; 0 = mod, 1 = pb
   refS[_whlMode].b  = false; // standard vs. fine tune mode
   refS[_mdSticky].b = false;
@@ -204,6 +233,9 @@ void load_factory_defaults_to(hexBoard_Setting_Array& refS, int version = 0) {
   refS[_synthVol].i = 96;
   refS[_synthBuz].b = false;
   refS[_synthJac].b = true || (version >= 12);
+  refS[_clockMode].i = _clockMode_off;
+  refS[_tempoBPM].i  = 120;
+  refS[_pbRange].i   = 2;  // global bend, semitones. _MPEpb is per note
 }
 
 hexBoard_Setting_Array settings;
\ No newline at end of file
@@ -0,0 +1,218 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+#include <atomic>
+
+/*
+ *  Tempo and MIDI clock.
+ *
+ *  As clock master a timer of its own ticks at 24 PPQN and
+ *  the clock bytes go out on each MIDI port ahead of any
+ *  other message. As slave the tempo follows the 0xF8s
+ *  coming in, smoothed so the jitter of USB polling and
+ *  loop() timing doesn't wobble the tempo. The slave takes
+ *  its first tempo from the first clock interval after a
+ *  start, not from the tempo setting, so it locks to any
+ *  source from tempo_min_BPM to tempo_max_BPM.
+ *
+ *  Either way the result is a beat phase: one beat is 2^24,
+ *  so the phase wraps every 256 beats and the low 24 bits
+ *  are the fraction of the beat. Each clock publishes a
+ *  snapshot (when, what phase, how fast) and a reader works
+ *  out the phase at any moment from that. Snapshots sit in
+ *  a small ring and only the index is swapped, so readers
+ *  on either core or in an interrupt never wait and never
+ *  see a half-written snapshot. Nothing here touches the
+ *  hardware, so it runs as is on a host with made-up
+ *  clock timestamps.
+ */
+
+const uint32_t MIDI_clock_PPQN     = 24;
+const int      beat_phase_bits     = 24;
+const uint32_t beat_phase_one      = 1u << beat_phase_bits;
+const int      tempo_rate_bits     = 16;   // phase per uS, fixed point
+const size_t   tempo_snapshot_ring = 4;    // power of 2
+const uint32_t tempo_min_BPM       = 20;
+const uint32_t tempo_max_BPM       = 300;
+// the slave tempo moves 1/2^n of the way to each new clock
+// interval, and the phase 1/2^n of the way to each clock.
+const int      tempo_period_smoothing = 3;
+const int      tempo_phase_smoothing  = 2;
+// this many odd intervals in a row is a new tempo, not a
+// hiccup: the slave starts over from the next interval
+const uint8_t  tempo_outliers_to_reseed = 4;
+
+// clock interval in 1/256ths of a uS
+constexpr uint32_t tempo_period_q8(uint32_t BPM) {
+  return (uint32_t)((60'000'000ull << 8) / ((uint64_t)BPM * MIDI_clock_PPQN));
+}
+// phase of the n-th clock since the start
+constexpr uint32_t clock_phase(uint32_t n) {
+  return (uint32_t)(((uint64_t)n << beat_phase_bits) / MIDI_clock_PPQN);
+}
+
+struct Tempo_Snapshot {
+  uint32_t at_uS;
+  uint32_t phase;
+  uint32_t rate;    // phase per uS << tempo_rate_bits, 0 = stopped
+};
+
+struct Tempo_Engine {
+  std::array<Tempo_Snapshot, tempo_snapshot_ring> ring;
+  std::atomic<uint32_t> published;
+  uint32_t clocks;          // since the start
+  uint32_t period_q8;
+  // master
+  std::atomic<uint32_t> requested_BPM;
+  std::atomic<uint32_t> clocks_due;    // ticked but not yet sent
+  uint32_t carry_q8;
+  // slave
+  uint32_t last_clock_uS;
+  bool     running;
+  bool     restarted;       // the next clock is the downbeat
+  bool     seeded;          // period_q8 is from the clocks
+  uint8_t  outliers;        // odd intervals in a row
+
+  Tempo_Engine()
+  : published(0), clocks(0), period_q8(tempo_period_q8(120))
+  , requested_BPM(120), clocks_due(0), carry_q8(0)
+  , last_clock_uS(0), running(false), restarted(true)
+  , seeded(false), outliers(0) {
+    ring.fill({0, 0, 0});
+  }
+
+  static uint32_t rate_of(uint32_t period_q8) {
+    return (uint32_t)(((uint64_t)beat_phase_one << (8 + tempo_rate_bits))
+                      / ((uint64_t)MIDI_clock_PPQN * period_q8));
+  }
+  void publish(uint32_t at_uS, uint32_t phase, uint32_t rate) {
+    uint32_t next = published.load(std::memory_order_relaxed) + 1;
+    ring[next & (tempo_snapshot_ring - 1)] = {at_uS, phase, rate};
+    published.store(next, std::memory_order_release);
+  }
+
+  // --- readers, any core, any context ---
+
+  Tempo_Snapshot snapshot() const {
+    return ring[published.load(std::memory_order_acquire) & (tempo_snapshot_ring - 1)];
+  }
+  // now_uS can be a little before the snapshot, if it was
+  // read just before a clock came in
+  uint32_t phase(uint32_t now_uS) const {
+    Tempo_Snapshot s = snapshot();
+    int32_t elapsed = now_uS - s.at_uS;
+    return s.phase + (uint32_t)(((int64_t)elapsed * s.rate) >> tempo_rate_bits);
+  }
+  // 0 - 2^24 through the current beat
+  uint32_t beat_fraction(uint32_t now_uS) const {
+    return phase(now_uS) & (beat_phase_one - 1);
+  }
+  bool is_running() const {
+    return snapshot().rate != 0;
+  }
+  uint32_t BPM() const {
+    uint64_t per_beat_q8 = (uint64_t)period_q8 * MIDI_clock_PPQN;
+    return (uint32_t)(((60'000'000ull << 8) + per_beat_q8 / 2) / per_beat_q8);
+  }
+
+  // --- control, from loop() ---
+
+  // master = the clock timer is about to start ticking,
+  // otherwise stand still until told otherwise
+  void reset(bool master, uint32_t now_uS) {
+    clocks = 0;
+    carry_q8 = 0;
+    clocks_due.store(0, std::memory_order_relaxed);
+    running = false;
+    restarted = true;
+    seeded = false;
+    period_q8 = tempo_period_q8(requested_BPM.load(std::memory_order_relaxed));
+    publish(now_uS, 0, (master ? rate_of(period_q8) : 0));
+  }
+  // the master picks this up on its next tick
+  void set_BPM(uint32_t BPM) {
+    if (BPM < tempo_min_BPM) BPM = tempo_min_BPM;
+    if (BPM > tempo_max_BPM) BPM = tempo_max_BPM;
+    requested_BPM.store(BPM, std::memory_order_relaxed);
+  }
+
+  // --- master, from the clock timer only ---
+
+  // returns the uS until the next tick. the fraction of
+  // a uS is carried so the tempo doesn't drift.
+  uint32_t master_tick(uint32_t now_uS) {
+    period_q8 = tempo_period_q8(requested_BPM.load(std::memory_order_relaxed));
+    ++clocks;
+    publish(now_uS, clock_phase(clocks), rate_of(period_q8));
+    clocks_due.fetch_add(1, std::memory_order_release);
+    carry_q8 += period_q8;
+    uint32_t delay_uS = carry_q8 >> 8;
+    carry_q8 &= 0xFF;
+    return delay_uS;
+  }
+  // for the MIDI out: how many clock bytes to send now.
+  // one read-and-clear, so a tick landing in between is
+  // kept for the next pass instead of lost.
+  uint32_t take_clocks_due() {
+    return clocks_due.exchange(0, std::memory_order_acquire);
+  }
+
+  // --- slave, from the MIDI input ---
+
+  void on_start(uint32_t now_uS) {
+    clocks = 0;
+    running = true;
+    restarted = true;
+    seeded = false;
+    publish(now_uS, 0, 0);
+  }
+  void on_continue(uint32_t now_uS) {
+    running = true;
+  }
+  void on_stop(uint32_t now_uS) {
+    running = false;
+    publish(now_uS, phase(now_uS), 0);
+  }
+  void on_clock(uint32_t now_uS) {
+    uint32_t interval = now_uS - last_clock_uS;
+    last_clock_uS = now_uS;
+    if (!running) return;
+    if (restarted) {
+      // the first clock after a start is the downbeat
+      restarted = false;
+      publish(now_uS, 0, rate_of(period_q8));
+      return;
+    }
+    ++clocks;
+    uint64_t measured_q8 = (uint64_t)interval << 8;
+    uint32_t lo = tempo_period_q8(tempo_max_BPM);
+    uint32_t hi = tempo_period_q8(tempo_min_BPM);
+    if (!seeded) {
+      // the first interval in range is the tempo
+      if ((measured_q8 >= lo) && (measured_q8 <= hi)) {
+        period_q8 = measured_q8;
+        seeded = true;
+        outliers = 0;
+      }
+    } else if ((measured_q8 < 4 * (uint64_t)period_q8) && (2 * measured_q8 > period_q8)) {
+      // follow a tempo change, smoothed
+      int64_t error = (int64_t)measured_q8 - period_q8;
+      period_q8 += error >> tempo_period_smoothing;
+      outliers = 0;
+    } else if (++outliers >= tempo_outliers_to_reseed) {
+      // not a dropped clock or a stall in loop(): the
+      // source jumped to a tempo of its own
+      seeded = false;
+    }
+    if (period_q8 < lo) period_q8 = lo;
+    if (period_q8 > hi) period_q8 = hi;
+    // pull the phase toward where this clock says it is.
+    // more than a clock off means we lost track: jump.
+    uint32_t target = clock_phase(clocks);
+    int32_t  error  = (int32_t)(target - phase(now_uS));
+    int32_t  one    = clock_phase(1);
+    uint32_t p = ((error > one) || (error < -one)) ? target
+               : phase(now_uS) + (error >> tempo_phase_smoothing);
+    publish(now_uS, p, rate_of(period_q8));
+  }
+};
@@ -0,0 +1,397 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+#include <bitset>
+
+/*
+ *  Tuning library.
+ *
+ *  Equal divisions of the equave (EDO) and moment-of-
+ *  symmetry (MOS) scales made of large and small steps.
+ *  Nothing here allocates: scales are stored as bit masks
+ *  (bit i set = step i is large) in fixed-size arrays, and
+ *  most of it is constexpr, so the checks at the bottom of
+ *  this file run at compile time.
+ */
+
+const int max_EDO      = 256;  // largest EDO a MOS can be mapped onto
+const int max_MOS_size = 64;   // large + small steps, one bit each
+
+constexpr int gcd(int a, int b) {
+  if (a < 0) a = -a;
+  if (b < 0) b = -b;
+  while (b) {
+    int r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+// floor division, so that negative steps land in the equave below
+constexpr int floor_div(int n, int d) {
+  return n / d - ((n % d != 0) && ((n < 0) != (d < 0)));
+}
+
+constexpr int closer_to_zero(int a, int b) {
+  return ((b < 0 ? -b : b) < (a < 0 ? -a : a) ? b : a);
+}
+
+// number of EDO steps nearest to a 3/2 fifth.
+// log2(3/2) = 0.5849625007211562, scaled to stay in integers.
+constexpr int EDO_fifth(int EDO) {
+  return (EDO * 5849625007211562LL + 5000000000000000LL) / 10000000000000000LL;
+}
+
+// how the diatonic scale is spelled in an EDO, used
+// to work out which palette tier each degree gets.
+struct EDO_Spelling {
+  int EDO;
+  int fifth;
+  int fourth;
+  int sharp;
+  int major2;
+  int minor2;
+  int minor3;
+
+  constexpr EDO_Spelling(int n)
+  : EDO(n)
+  // for 13EDO and 18EDO it is preferable to round down
+  // to the "flatter" fifth and not up to the "sharper" fifth
+  , fifth(EDO_fifth(n) - ((n == 13) || (n == 18)))
+  , fourth(n - fifth)
+  , sharp(7 * fifth - 4 * n)
+  , major2(2 * fifth - n)
+  , minor2(major2 - sharp)
+  , minor3(fourth - major2) {}
+
+  // below 10EDO the sharps and flats run into the naturals
+  // (7EDO has no sharps at all, in 9EDO they go flat), so
+  // the algorithm below doesn't work. instead the seven
+  // naturals, the chain of fifths from F to B, are tier 0
+  // and every other step is tier 1: 6EDO is C D E white
+  // and the steps between black, 9EDO has two black keys.
+  constexpr int small_EDO_tier(int degree) const {
+    int d = ((degree % EDO) + EDO) % EDO;
+    for (int k = -1; k <= 5; ++k) {
+      if ((((k * fifth) % EDO) + EDO) % EDO == d) return 0;
+    }
+    return 1;
+  }
+
+  // the white keys are tier 0 (C D E F G A B)
+  // the black keys are tier 1 (C#, Db, etc.)
+  // in larger EDOs you get other tiers like:
+  // tier -1: E# B# Fb Cb if they're separate
+  // tier 2/-2 or larger for other microtonal steps
+  // the algorithm works by knowing how to spell
+  // D and E, then treating all C F G & A's like D
+  // and treating B like E. we are assuming the
+  // "key" is "C", so that C = zero steps.
+  constexpr int tier(int degree) const {
+    if (EDO < 10) return small_EDO_tier(degree);
+    // G, A, and B are spelled the same as C, D, and E.
+    // so take the scale degree modulo the 5th.
+    int s = degree % fifth;
+    // C is spelled like D, but D is now going to be zero.
+    if (s >= major2) { s -= major2; }
+    // G is spelled like F.
+    if (s >= fourth) { s -= major2; }
+    // F is spelled like D.
+    if (s >= minor3) { s -= minor3; }
+    if (s == 0)                 return  0; // C, D, F, G, and A are white keys.
+    if (s == major2)            return  0; // E and B are white keys.
+    if (s == sharp)             return  1; // C#, D#, F#, G#, and A# are black keys.
+    if (s == minor2)            return  1; // Db, Eb, Gb, Ab, and Bb are black keys.
+    if (s == major2 + sharp)    return -1; // E# and B# get a different color if needed.
+    if (s == minor3 - sharp)    return -1; // Fb and Cb get a different color if needed.
+    // if the note isn't one of those, then find how many microtonal steps
+    // away it is from a white or black key (not from E#/Fb).
+    int t = s;
+    t = closer_to_zero(t, s - minor3);
+    t = closer_to_zero(t, s - major2);
+    t = closer_to_zero(t, s - minor2);
+    t = closer_to_zero(t, s - sharp);
+    // then increase by one so that you start counting
+    // at tier 2, 3, ... if sharp, or -2, -3, ... if flat.
+    // e.g. D^ is one microtonal step sharp of D, tier +2.
+    //      Dv is one microtonal step flat of D, tier -2.
+    //      Bb^^ is two microtonal steps sharp of Bb, tier 3.
+    return t + (t > 0 ? 1 : -1);
+  }
+};
+
+constexpr uint64_t low_bits(int n) {
+  return (n >= 64 ? ~0ull : (1ull << n) - 1);
+}
+
+// a MOS scale with Lg large and Sm small steps per equave.
+// rather than build the step pattern recursively, use the
+// closed form: in the brightest mode, step i is large if
+// ceil((i + 1) * L / n) > ceil(i * L / n), for the reduced
+// pattern of L = Lg / K large out of n = (Lg + Sm) / K
+// steps, repeated K = gcd(Lg, Sm) times. each next mode
+// is one bright generator (G steps) darker.
+// for 5L 2s, mode 0 is Lydian, mode 1 is major, etc.
+struct MOS_Scale {
+  int      Lg;
+  int      Sm;
+  int      K;      // gcd
+  int      size;   // Lg + Sm
+  int      modes;  // distinct modes, (Lg + Sm) / K
+  int      G;      // bright generator, in steps
+  uint64_t steps;  // brightest mode, bit i set = step i is large
+
+  constexpr MOS_Scale(int L, int S)
+  : Lg(L), Sm(S), K(gcd(L, S)), size(L + S)
+  , modes(0), G(0), steps(0) {
+    if (!valid()) return;
+    int l = Lg / K;
+    int n = size / K;
+    modes = n;
+    for (int m = 1; m < n; ++m) {
+      if (((Sm / K) * m) % n == 1) { G = m; break; }
+    }
+    if (n == 1) G = 0;
+    for (int i = 0; i < size; ++i) {
+      int j = i % n;
+      // ceil(a / n) for a >= 0
+      int hi = ((j + 1) * l + n - 1) / n;
+      int lo = (j * l + n - 1) / n;
+      if (hi > lo) steps |= (1ull << i);
+    }
+  }
+
+  constexpr bool valid() const {
+    return (Lg > 0) && (Sm > 0) && (size <= max_MOS_size);
+  }
+  // step pattern of a mode, as a bit mask
+  constexpr uint64_t mode_steps(int mode) const {
+    int r = ((mode % modes + modes) % modes) * G % size;
+    if (r == 0) return steps;
+    return ((steps >> r) | (steps << (size - r))) & low_bits(size);
+  }
+  // large steps among the first k steps of a mode
+  constexpr int large_before(int mode, int k) const {
+    return __builtin_popcountll(mode_steps(mode) & low_bits(k));
+  }
+  // is the note lg large + sm small steps up from the
+  // tonic (within one equave) a degree of this mode?
+  constexpr bool in_mode(int mode, int lg, int sm) const {
+    int k = lg + sm;
+    if ((lg < 0) || (sm < 0) || (k >= size)) return false;
+    return large_before(mode, k) == lg;
+  }
+  // 0 = in the mode, 1 = in another mode, -1 = neither
+  constexpr int tier(int mode, int lg, int sm) const {
+    if (in_mode(mode, lg, sm)) return 0;
+    for (int m = 0; m < modes; ++m) {
+      if (in_mode(m, lg, sm)) return 1;
+    }
+    return -1;
+  }
+};
+
+// when the large / small ratio is a fraction N / D,
+// the MOS lives inside an EDO of Lg * N + Sm * D steps.
+// notes are then compared by EDO degree, so enharmonic
+// spellings get the same tier.
+struct MOS_in_EDO {
+  int EDO;
+  int N;
+  int D;
+  std::bitset<max_EDO> in_mode;
+  std::bitset<max_EDO> in_any_mode;
+
+  MOS_in_EDO(const MOS_Scale& mos, int mode, int n, int d)
+  : EDO(mos.Lg * n + mos.Sm * d), N(n), D(d) {
+    if (!valid() || !mos.valid()) return;
+    for (int m = 0; m < mos.modes; ++m) {
+      uint64_t s = mos.mode_steps(m);
+      int degree = 0;
+      for (int i = 0; i < mos.size; ++i) {
+        in_any_mode.set(degree);
+        if (m == ((mode % mos.modes) + mos.modes) % mos.modes) in_mode.set(degree);
+        degree += ((s >> i) & 1 ? N : D);
+      }
+    }
+  }
+  bool valid() const {
+    return (N > 0) && (D > 0) && (EDO > 0) && (EDO <= max_EDO);
+  }
+  int degree(int lg, int sm) const {
+    return lg * N + sm * D;
+  }
+  int tier(int degree) const {
+    if (in_mode[degree])     return 0;
+    if (in_any_mode[degree]) return 1;
+    return -1;
+  }
+};
+
+// just intonation. a ratio is kept as a monzo, the list of
+// exponents of each prime (9/8 = 2^-3 * 3^2 = [-3 2>), so
+// stacking intervals across the lattice is exact integer
+// addition and only the final pitch is converted to cents.
+const size_t prime_count = 11;
+constexpr int primes[prime_count] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31};
+// 1200 * log2(prime)
+constexpr double prime_cents[prime_count] = {
+  1200.0,             1901.9550008653873, 2786.3137138648344, 3368.825906469125,
+  4151.317942364757,  4440.527661769311,  4904.955409500407,  5097.513016132302,
+  5428.274347268416,  5829.577194153087,  5945.0355724642495
+};
+
+struct Monzo {
+  std::array<int16_t, prime_count> e;
+  bool exact;  // false if the ratio had a prime factor above 31
+
+  constexpr Monzo() : e{}, exact(true) {}
+  constexpr Monzo(int num, int den) : e{}, exact(num > 0 && den > 0) {
+    if (!exact) return;
+    for (size_t p = 0; p < prime_count; ++p) {
+      while (num % primes[p] == 0) { num /= primes[p]; ++e[p]; }
+      while (den % primes[p] == 0) { den /= primes[p]; --e[p]; }
+    }
+    exact = (num == 1) && (den == 1);
+  }
+  constexpr Monzo operator+(const Monzo& rhs) const {
+    Monzo result;
+    for (size_t p = 0; p < prime_count; ++p) result.e[p] = e[p] + rhs.e[p];
+    result.exact = exact && rhs.exact;
+    return result;
+  }
+  constexpr Monzo operator*(int n) const {
+    Monzo result;
+    for (size_t p = 0; p < prime_count; ++p) result.e[p] = e[p] * n;
+    result.exact = exact;
+    return result;
+  }
+  constexpr bool operator==(const Monzo& rhs) const {
+    for (size_t p = 0; p < prime_count; ++p) {
+      if (e[p] != rhs.e[p]) return false;
+    }
+    return true;
+  }
+  // largest prime in the ratio, ignoring octaves.
+  // 1 for octaves and unison.
+  constexpr int limit() const {
+    for (size_t p = prime_count; p-- > 1;) {
+      if (e[p]) return primes[p];
+    }
+    return 1;
+  }
+  double cents() const {
+    double result = 0.0;
+    for (size_t p = 0; p < prime_count; ++p) result += e[p] * prime_cents[p];
+    return result;
+  }
+};
+
+// palette tier by prime limit: Pythagorean (3-limit) notes
+// are tier 0, then each higher prime gets its own tier.
+constexpr int JI_tier(int limit) {
+  switch (limit) {
+    case 1: case 3: return  0;
+    case 5:         return  1;
+    case 7:         return -1;
+    case 11:        return  2;
+    case 13:        return -2;
+    case 17:        return  3;
+    default:        return -3;
+  }
+}
+
+// compile-time checks, in place of host unit tests
+
+static_assert(gcd(12, 8) == 4, "gcd");
+static_assert(gcd(7, 0) == 7, "gcd");
+static_assert(gcd(-9, 6) == 3, "gcd");
+static_assert(floor_div(-1, 12) == -1, "floor_div");
+static_assert(floor_div(12, 12) == 1, "floor_div");
+static_assert(EDO_fifth(12) == 7 && EDO_fifth(19) == 11 && EDO_fifth(31) == 18
+           && EDO_fifth(53) == 31 && EDO_fifth(72) == 42, "fifths");
+
+constexpr int tiers_of_12EDO[12] = {0,1,0,1,0,0,1,0,1,0,1,0};
+constexpr bool check_12EDO() {
+  for (int d = 0; d < 12; ++d) {
+    if (EDO_Spelling(12).tier(d) != tiers_of_12EDO[d]) return false;
+  }
+  return true;
+}
+static_assert(check_12EDO(), "12EDO spells as the piano");
+
+// for every EDO with a usable diatonic scale, the seven
+// natural notes are tier 0 and the sharps / flats tier 1.
+// every EDO keeps its tiers in range.
+constexpr bool check_diatonic_EDOs(int lo, int hi) {
+  for (int n = lo; n <= hi; ++n) {
+    EDO_Spelling e(n);
+    for (int d = 0; d < n; ++d) {
+      int t = e.tier(d);
+      if ((t < -n) || (t > n)) return false;
+    }
+    if ((e.sharp <= 0) || (e.minor2 <= 0)) continue;
+    const int naturals[7] = {0, e.major2, 2 * e.major2, e.fourth,
+                             e.fifth, e.fifth + e.major2, e.fifth + 2 * e.major2};
+    for (int d : naturals) {
+      if (e.tier(d) != 0) return false;
+    }
+    if (e.tier(e.sharp) != 1)               return false; // C#
+    if (e.tier(e.major2 + e.minor2) != 1)   return false; // Eb
+  }
+  return true;
+}
+static_assert(check_diatonic_EDOs(5, 72), "EDO spellings");
+
+// 5EDO to 9EDO, tier of each step
+constexpr int tiers_of_small_EDOs[5][9] = {
+  {0,0,0,0,0},          // 5: pentatonic, all naturals
+  {0,1,0,1,0,1},        // 6: whole tone, C D E and the steps between
+  {0,0,0,0,0,0,0},      // 7: all naturals
+  {0,0,0,0,0,0,1,0},    // 8
+  {0,0,0,1,0,0,0,0,1},  // 9: mavila, two accidentals
+};
+constexpr bool check_small_EDOs() {
+  for (int n = 5; n <= 9; ++n) {
+    for (int d = 0; d < n; ++d) {
+      if (EDO_Spelling(n).tier(d) != tiers_of_small_EDOs[n - 5][d]) return false;
+    }
+  }
+  return true;
+}
+static_assert(check_small_EDOs(), "5EDO - 9EDO spellings");
+
+static_assert(MOS_Scale(5, 2).steps == 0b0110111, "5L 2s brightest mode is Lydian");
+static_assert(MOS_Scale(5, 2).G == 4, "5L 2s generator is a fifth");
+static_assert(MOS_Scale(5, 2).mode_steps(1) == 0b0111011, "mode 1 of 5L 2s is major");
+static_assert(MOS_Scale(5, 2).mode_steps(6) == 0b1110110, "mode 6 of 5L 2s is Locrian");
+static_assert(MOS_Scale(2, 5).mode_steps(0) == 0b0001001, "2L 5s brightest mode is LssLsss");
+static_assert(MOS_Scale(4, 4).modes == 2 && MOS_Scale(4, 4).steps == 0b01010101, "octatonic");
+static_assert(MOS_Scale(5, 3).large_before(0, 8) == 5, "oneirotonic");
+static_assert(MOS_Scale(5, 2).in_mode(1, 2, 0), "major third");
+static_assert(MOS_Scale(5, 2).tier(1, 3, 0) == 1, "#4 is in Lydian, not in major");
+static_assert(MOS_Scale(5, 2).tier(1, 4, 0) == -1, "no mode has an augmented fifth");
+
+// every mode of a MOS has the same number of large steps,
+// and the modes are all different rotations
+constexpr bool check_MOS(int L, int S) {
+  MOS_Scale mos(L, S);
+  if (!mos.valid()) return false;
+  for (int m = 0; m < mos.modes; ++m) {
+    if (mos.large_before(m, mos.size) != L) return false;
+    for (int m2 = 0; m2 < m; ++m2) {
+      if (mos.mode_steps(m) == mos.mode_steps(m2)) return false;
+    }
+  }
+  return true;
+}
+static_assert(check_MOS(5, 2) && check_MOS(2, 5) && check_MOS(1, 1) && check_MOS(4, 3)
+           && check_MOS(3, 4) && check_MOS(5, 3) && check_MOS(7, 5) && check_MOS(6, 6)
+           && check_MOS(2, 8) && check_MOS(9, 4) && check_MOS(10, 2), "MOS modes");
+
+static_assert(Monzo(9, 8).e[0] == -3 && Monzo(9, 8).e[1] == 2 && Monzo(9, 8).exact, "9/8");
+static_assert(Monzo(3, 2) + Monzo(4, 3) == Monzo(2, 1), "fifth + fourth = octave");
+static_assert(Monzo(81, 80) == Monzo(9, 8) * 2 + Monzo(4, 5), "syntonic comma");
+static_assert(Monzo(5, 4).limit() == 5 && Monzo(2, 1).limit() == 1 && Monzo(7, 6).limit() == 7, "limits");
+static_assert(!Monzo(37, 32).exact && !Monzo(0, 1).exact, "ratios outside the lattice");
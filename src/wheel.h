@@ -0,0 +1,189 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include "config.h"
+
+/*
+ *  Control wheels: mod wheel, pitch bend and velocity.
+ *
+ *  There is no physical wheel. The seven command keys on
+ *  the left edge push each wheel toward a value, and the
+ *  knob (from the play mode dashboard) sets where a wheel
+ *  rests. A wheel never jumps: on a fixed-rate timer it
+ *  moves toward its target by at most its speed per tick,
+ *  and bumps a counter when it moved. loop() looks at the
+ *  counter and sends MIDI and updates the synth, so there
+ *  is at most one update per wheel per tick however fast
+ *  the keys or the knob go.
+ *
+ *  The target is only written from loop() and the value
+ *  only from the timer, so neither needs a lock.
+ *
+ *  Keys, top to bottom:
+ *    0 - 2   velocity up / middle / down
+ *    3       switch keys 4 - 6 between mod and pitch bend
+ *    4 - 6   mod or pitch bend up / middle / down
+ *
+ *  In the standard mode the keys held pick a position
+ *  (top, 3/4, rest, 1/4, bottom) and letting go returns
+ *  the wheel to rest, unless it is sticky. In the fine
+ *  tune mode (_whlMode) top and bottom go to the ends,
+ *  both go to rest, and holding the middle key turns the
+ *  top and bottom keys into single steps.
+ */
+
+enum {
+  _wheel_mod,
+  _wheel_bend,
+  _wheel_velocity,
+  _wheel_count
+};
+
+enum {
+  _cmd_velocity_up,
+  _cmd_velocity_mid,
+  _cmd_velocity_down,
+  _cmd_wheel_toggle,
+  _cmd_wheel_up,
+  _cmd_wheel_mid,
+  _cmd_wheel_down,
+  _cmd_count
+};
+const uint8_t no_command = 0xFF;
+
+// the left edge of the board, numbered from the top
+uint8_t command_slot(int x, int y) {
+  if (x > hex_x_min + 1) return no_command;
+  if ((y < 0) || (y >= _cmd_count)) return no_command;
+  return y;
+}
+
+enum {
+  _wheel_key_down = 1u << 0,
+  _wheel_key_mid  = 1u << 1,
+  _wheel_key_up   = 1u << 2
+};
+
+struct Wheel {
+  int16_t min;
+  int16_t max;
+  int16_t rest;       // where it goes when let go
+  int16_t target;     // loop() only
+  int16_t value;      // timer only
+  int32_t step;       // per tick, 0 = no slew
+  bool    sticky;
+  uint8_t keys;
+  std::atomic<uint32_t> moves;
+
+  Wheel(int16_t lo, int16_t hi, int16_t r)
+  : min(lo), max(hi), rest(r), target(r), value(r)
+  , step(0), sticky(false), keys(0), moves(0) {}
+
+  int16_t clamp(int32_t v) const {
+    return (v < min ? min : (v > max ? max : v));
+  }
+  // the knob moves the rest position, and the wheel with it
+  void set(int32_t v) {
+    rest = target = clamp(v);
+  }
+
+  void aim(bool fine_tune) {
+    if (fine_tune) {
+      if (keys & _wheel_key_mid) return;   // stepping, see tap()
+      switch (keys & (_wheel_key_up | _wheel_key_down)) {
+        case _wheel_key_up:                  target = max;  break;
+        case _wheel_key_down:                target = min;  break;
+        case _wheel_key_up | _wheel_key_down: target = rest; break;
+        default:                                             break;
+      }
+      return;
+    }
+    switch (keys) {
+      case _wheel_key_up:                  target = max;                   break;
+      case _wheel_key_up | _wheel_key_mid:   target = (3 * max + min) / 4;   break;
+      case _wheel_key_mid | _wheel_key_down: target = (max + 3 * min) / 4;   break;
+      case _wheel_key_down:                target = min;                   break;
+      case 0:                              target = rest;                  break;
+      default:                             target = rest;                  break;
+    }
+  }
+  // a key went down or up
+  void press(uint8_t key, bool down, bool fine_tune) {
+    if (down) keys |= key; else keys &= ~key;
+    // a sticky wheel stays where the last press put it,
+    // whatever order the keys are let go in
+    if (!down && sticky) return;
+    if (fine_tune && down && (keys & _wheel_key_mid)) {
+      int32_t d = (step ? step : 1);
+      if (key == _wheel_key_up)   target = clamp(target + d);
+      if (key == _wheel_key_down) target = clamp(target - d);
+    }
+    aim(fine_tune);
+  }
+  void release_all(bool fine_tune) {
+    keys = 0;
+    if (!sticky) aim(fine_tune);
+  }
+
+  // from the timer. true if the value moved.
+  bool tick() {
+    int32_t t = target;
+    int32_t d = t - value;
+    if (d == 0) return false;
+    if ((step == 0) || (d <= step && -d <= step)) {
+      value = t;
+    } else {
+      value += (d > 0 ? step : -step);
+    }
+    moves.store(moves.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    return true;
+  }
+};
+
+struct Wheel_Engine {
+  std::array<Wheel, _wheel_count> wheel;
+  std::array<uint32_t, _wheel_count> seen;
+  bool bend_on_keys;    // _tglWheel, keys 4 - 6 work the pitch bend
+  bool fine_tune;       // _whlMode
+
+  Wheel_Engine()
+  : wheel{{ Wheel(0, 127, 0), Wheel(-8192, 8191, 0), Wheel(0, 127, 96) }}
+  , bend_on_keys(false), fine_tune(false) {
+    seen.fill(0);
+  }
+
+  Wheel& keyed_wheel() {
+    return wheel[bend_on_keys ? _wheel_bend : _wheel_mod];
+  }
+  void set_keyed_wheel(bool bend) {
+    if (bend == bend_on_keys) return;
+    keyed_wheel().release_all(fine_tune);
+    bend_on_keys = bend;
+  }
+
+  void on_command_key(uint8_t cmd, bool down) {
+    switch (cmd) {
+      case _cmd_velocity_up:   wheel[_wheel_velocity].press(_wheel_key_up,   down, fine_tune); break;
+      case _cmd_velocity_mid:  wheel[_wheel_velocity].press(_wheel_key_mid,  down, fine_tune); break;
+      case _cmd_velocity_down: wheel[_wheel_velocity].press(_wheel_key_down, down, fine_tune); break;
+      case _cmd_wheel_toggle:  if (down) set_keyed_wheel(!bend_on_keys);                        break;
+      case _cmd_wheel_up:      keyed_wheel().press(_wheel_key_up,   down, fine_tune);          break;
+      case _cmd_wheel_mid:     keyed_wheel().press(_wheel_key_mid,  down, fine_tune);          break;
+      case _cmd_wheel_down:    keyed_wheel().press(_wheel_key_down, down, fine_tune);          break;
+      default:                                                                                  break;
+    }
+  }
+
+  // from the wheel timer
+  void tick() {
+    for (auto& w : wheel) w.tick();
+  }
+  // from loop(): true once for each tick the wheel moved in
+  bool take_moved(uint8_t w) {
+    uint32_t m = wheel[w].moves.load(std::memory_order_acquire);
+    if (m == seen[w]) return false;
+    seen[w] = m;
+    return true;
+  }
+};
@@ -0,0 +1,240 @@
+/*
+ *  Checks the MIDI message stream of MPE mode on the host:
+ *  the zone setup, a chord wider than the member channels
+ *  (stealing), legato lines, overlapped and not, and notes
+ *  held through a change of mode or zones. The USB
+ *  scheduler writes into a log instead of a port.
+ *
+ *  g++ -std=gnu++17 -O2 -Itests/host/stubs tests/host/MPE_test.cpp -o /tmp/MPE_test
+ *  /tmp/MPE_test
+ */
+#include <cstdio>
+#include <vector>
+#include "../../src/settings.h"
+#include "../../src/MIDI_api.h"
+
+HardwareSerial       Serial;
+HardwareSerial       Serial1;
+Adafruit_USBD_Device TinyUSBDevice;
+timer_hw_t           host_timer = {0, 0};
+timer_hw_t*          timer_hw = &host_timer;
+
+std::vector<MIDI_Message> sent;
+int write_log(const MIDI_Message& msg) {
+  sent.push_back(msg);
+  return MIDI_message_length(msg.status);
+}
+
+int failures = 0;
+void check(bool ok, const char* what) {
+  if (!ok) {
+    std::printf("FAIL: %s\n", what);
+    ++failures;
+  }
+}
+
+uint8_t type_of(const MIDI_Message& m)    { return m.status & 0xF0; }
+uint8_t channel_of(const MIDI_Message& m) { return (m.status & 0x0F) + 1; }
+
+bool USB_is_on = true;
+void start_MPE() {
+  MIDI_api = MIDI_API_Object();
+  MIDI_api._ptr_UMIDI_active = &USB_is_on;
+  MIDI_api.USB_out.writer = write_log;
+  MIDI_api.set_mode(_MIDImode_MPE);   // lower zone, channels 2 - 9
+  MIDI_api.service(0);
+  sent.clear();
+}
+uint8_t play(uint8_t who, uint8_t note) {
+  return MIDI_api.noteOn(who, 1, note, 8192 + who, 0, 100, 0x40);
+}
+void stop(uint8_t who, uint8_t channel, uint8_t note) {
+  MIDI_api.noteOff(who, channel, note, 0);
+}
+
+// each note-on goes out as timbre, pressure, bend, then
+// the note, all on the note's own channel.
+bool note_on_at(size_t k, uint8_t ch, uint8_t note, uint8_t who) {
+  if (k + 4 > sent.size()) return false;
+  const MIDI_Message* m = &sent[k];
+  return (type_of(m[0]) == 0xB0) && (m[0].data1 == 0x4A) && (channel_of(m[0]) == ch)
+      && (type_of(m[1]) == 0xD0) && (m[1].data1 == 0)    && (channel_of(m[1]) == ch)
+      && (type_of(m[2]) == 0xE0) && (m[2].data1 == who)  && (m[2].data2 == 0x40) && (channel_of(m[2]) == ch)
+      && (type_of(m[3]) == 0x90) && (m[3].data1 == note) && (channel_of(m[3]) == ch);
+}
+
+// the setup for two zones is 90 CCs, more than a queue
+// holds, sent before the port is serviced. every one has
+// to arrive, in order on its channel: select the RPN,
+// data entry MSB and LSB, then the null RPN.
+void setup_test() {
+  MIDI_api = MIDI_API_Object();
+  MIDI_api._ptr_UMIDI_active = &USB_is_on;
+  MIDI_api.USB_out.writer = write_log;
+  MIDI_api.configure_MPE(_MPE_zone_both, 9, 11, 48);
+  sent.clear();
+  MIDI_api.set_mode(_MIDImode_MPE);
+  MIDI_api.service(0);
+  check(sent.size() == 15 * 6, "setup: message count");
+  check(MIDI_api.USB_out.dropped == 0, "setup: nothing dropped");
+  for (uint8_t c = 1; c <= 16; ++c) {
+    if (c == 10) continue;
+    bool    master = (c == 1) || (c == 16);
+    uint8_t value  = (c == 1 ? 8 : (c == 16 ? 5 : 48));
+    const uint8_t expect[6][2] = {
+      {0x65, 0}, {0x64, uint8_t(master ? 6 : 0)}, {0x06, value}, {0x26, 0},
+      {0x65, 0x7F}, {0x64, 0x7F}
+    };
+    size_t k = 0;
+    for (const auto& m : sent) {
+      if (channel_of(m) != c) continue;
+      check((k < 6) && (type_of(m) == 0xB0) && (m.data1 == expect[k][0]) && (m.data2 == expect[k][1]),
+            "setup: RPN sequence on each channel");
+      ++k;
+    }
+    check(k == 6, "setup: every RPN reaches the writer");
+  }
+  // the wheels go to both master channels
+  uint8_t ch[2];
+  check((MIDI_api.zone_channels(1, ch) == 2) && (ch[0] == 1) && (ch[1] == 16),
+        "setup: zone-wide controls on both masters");
+}
+
+// a port that never takes anything (USB with no host
+// reading) can't hold up loop() for more than a timeout
+uint32_t stalled_writes = 0;
+int write_stalled(const MIDI_Message&) {
+  ++stalled_writes;
+  timer_hw->timerawl += 10;
+  return -1;
+}
+void stall_test() {
+  MIDI_api = MIDI_API_Object();
+  MIDI_api._ptr_UMIDI_active = &USB_is_on;
+  MIDI_api.USB_out.writer = write_stalled;
+  MIDI_api.configure_MPE(_MPE_zone_both, 9, 11, 48);
+  MIDI_api.set_mode(_MIDImode_MPE);
+  MIDI_api.USB_out.drain();
+  check(MIDI_api.USB_out.dropped == 15 * 6, "stall: forced messages dropped");
+  check(stalled_writes < 2 * MIDI_force_timeout_uS / 10 + 90, "stall: one timeout, then no more waiting");
+}
+
+// a note queued before an overflow still goes out ahead
+// of the controls after it on its channel
+void overflow_order_test() {
+  start_MPE();
+  MIDI_api.sendNoteOff(60, 0, 2);
+  MIDI_api.configure_MPE(_MPE_zone_both, 9, 11, 48);
+  MIDI_api.service(0);
+  check((sent.size() == 1 + 15 * 6) && (type_of(sent[0]) == 0x80),
+        "overflow: the queued note goes first");
+}
+
+void chord_test() {
+  start_MPE();
+  uint8_t ch[10];
+  for (uint8_t who = 0; who < 10; ++who) ch[who] = play(who, 60 + who);
+  MIDI_api.service(0);
+  // the first eight each get a channel of their own
+  for (uint8_t who = 0; who < 8; ++who) {
+    check(ch[who] == who + 2, "chord: channels handed out in order");
+    check(note_on_at(4 * who, ch[who], 60 + who, who), "chord: note-on stream");
+  }
+  // then the two oldest notes are stolen, note-off first
+  check(ch[8] == 2 && ch[9] == 3, "chord: oldest notes stolen");
+  check(sent.size() == 8 * 4 + 2 * 5, "chord: message count");
+  for (uint8_t k = 0; k < 2; ++k) {
+    const MIDI_Message& off = sent[32 + 5 * k];
+    check((type_of(off) == 0x80) && (channel_of(off) == ch[8 + k]) && (off.data1 == 60 + k),
+          "chord: stolen note is turned off");
+    check(note_on_at(33 + 5 * k, ch[8 + k], 68 + k, 8 + k), "chord: stealing note-on stream");
+  }
+  // a stolen key's pressure and release go nowhere
+  sent.clear();
+  MIDI_api.notePressure(0, ch[0], 60, 50);
+  stop(0, ch[0], 60);
+  MIDI_api.notePressure(5, ch[5], 65, 50);
+  MIDI_api.notePressure(6, 0, 66, 50);   // never sounded
+  MIDI_api.service(0);
+  check(sent.size() == 1, "chord: only the live key's pressure goes out");
+  check(!sent.empty() && (type_of(sent[0]) == 0xD0) && (channel_of(sent[0]) == ch[5]),
+        "chord: pressure on the key's own channel");
+}
+
+void legato_test() {
+  start_MPE();
+  // let go, then the next note: it gets a fresh channel
+  // so the first note's release tail isn't cut
+  uint8_t a = play(0, 60);
+  stop(0, a, 60);
+  uint8_t b = play(1, 62);
+  MIDI_api.service(0);
+  check(a != b, "legato: a released channel is not reused first");
+  check(note_on_at(0, a, 60, 0), "legato: first note-on");
+  check((type_of(sent[4]) == 0x80) && (channel_of(sent[4]) == a), "legato: first note-off");
+  check(note_on_at(5, b, 62, 1), "legato: second note-on");
+
+  // overlapped: the next note starts before the last ends
+  sent.clear();
+  uint8_t c = play(2, 64);
+  stop(1, b, 62);
+  MIDI_api.service(0);
+  check((c != a) && (c != b), "legato: overlapping notes on their own channels");
+  check(note_on_at(0, c, 64, 2), "legato: overlapping note-on");
+  check((sent.size() == 5) && (type_of(sent[4]) == 0x80) && (channel_of(sent[4]) == b),
+        "legato: note-off on the old note's channel only");
+
+  // a line of notes comes back round to the first channel
+  // once the other seven have had their turn
+  uint8_t ch = c;
+  for (uint8_t who = 3; who < 9; ++who) {
+    stop(who - 1, ch, 61 + who);
+    ch = play(who, 62 + who);
+  }
+  check(ch == a, "legato: channels rotate least recently released first");
+}
+
+// a note held while the mode or the zones change is let go
+// on the channel it started on, and only once
+bool note_off_at(size_t k, uint8_t ch, uint8_t note) {
+  return (k < sent.size()) && (type_of(sent[k]) == 0x80)
+      && (channel_of(sent[k]) == ch) && (sent[k].data1 == note);
+}
+void mode_switch_test() {
+  std::array<uint8_t, 2> channel = {0, 0};
+  std::array<uint8_t, 2> table   = {60, 62};
+  MIDI_api = MIDI_API_Object();
+  MIDI_api._ptr_UMIDI_active = &USB_is_on;
+  MIDI_api.USB_out.writer = write_log;
+  channel[0] = MIDI_api.noteOn(0, 1, table[0], 8192, 0, 100, 0x40);
+  MIDI_api.service(0);
+  sent.clear();
+  MIDI_api.releaseNotes(channel, table);
+  MIDI_api.set_mode(_MIDImode_MPE);
+  MIDI_api.service(0);
+  check(note_off_at(0, 1, 60), "mode switch: held note let go on channel 1");
+  check(channel[0] == 0, "mode switch: key forgets its channel");
+
+  channel[1] = play(1, table[1]);
+  MIDI_api.service(0);
+  sent.clear();
+  MIDI_api.releaseNotes(channel, table);
+  MIDI_api.configure_MPE(_MPE_zone_both, 5, 11, 24);
+  MIDI_api.service(0);
+  check(note_off_at(0, 2, 62), "zone change: held MPE note let go on its channel");
+  sent.clear();
+  stop(1, channel[1], table[1]);   // the key comes up later
+  MIDI_api.service(0);
+  check(sent.empty(), "zone change: no second note-off");
+}
+
+int main() {
+  setup_test();
+  stall_test();
+  overflow_order_test();
+  chord_test();
+  legato_test();
+  mode_switch_test();
+  std::printf("%s\n", failures ? "MPE test failed" : "MPE test passed");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,52 @@
+/*
+ *  Times one LED frame of the animation engine on the host,
+ *  with 10 and with 40 (animation_pool_size) animations
+ *  running at once, every mode mixed in.
+ *
+ *  g++ -std=gnu++17 -O2 -Itests/host/stubs tests/host/animation_bench.cpp -o /tmp/animation_bench
+ *  /tmp/animation_bench
+ */
+#include <chrono>
+#include <cstdio>
+#include "../../src/animation.h"
+
+Button_Grid      grid(hexBoard_layout_hw_1_2);
+LED_Compositor   LEDs;
+Animation_Engine animation(grid);
+
+const int modes[] = {
+  _animType_star, _animType_splash, _animType_orbit, _animType_octave,
+  _animType_by_note, _animType_beams, _animType_splash_reverse, _animType_star_reverse
+};
+
+double uS_per_frame(size_t running) {
+  const int      fps    = 60;
+  const uint32_t frame  = (1u << 20) / fps + 1;   // one new frame per call
+  const int      frames = 20000;
+  for (auto& a : animation.pool) a = Animation_Instance();
+  for (size_t k = 0; k < running; ++k) {
+    animation.start((k * 37) % buttons_count, modes[k % 8], 0);
+  }
+  uint32_t now = 0;
+  auto began = std::chrono::steady_clock::now();
+  for (int f = 0; f < frames; ++f) {
+    now += frame;
+    // keep the rings going: restart any that ran out
+    for (auto& a : animation.pool) {
+      if (!a.active && (a.type != _animType_none)) { a.active = true; a.start_uS = now; }
+    }
+    animation.advance(now, fps, LEDs);
+  }
+  std::chrono::duration<double, std::micro> took = std::chrono::steady_clock::now() - began;
+  return took.count() / frames;
+}
+
+int main() {
+  uS_per_frame(40);   // warm up
+  std::printf("pool %zu, sizeof(Animation_Engine) %zu bytes\n",
+              animation_pool_size, sizeof(Animation_Engine));
+  std::printf(" 0 animations: %.2f uS per frame\n", uS_per_frame(0));
+  std::printf("10 animations: %.2f uS per frame\n", uS_per_frame(10));
+  std::printf("40 animations: %.2f uS per frame\n", uS_per_frame(40));
+  return 0;
+}
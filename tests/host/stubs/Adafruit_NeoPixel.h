@@ -0,0 +1,15 @@
+#pragma once
+#include "Arduino.h"
+#define NEO_GRB 0
+#define NEO_KHZ800 0
+struct Adafruit_NeoPixel {
+  void updateType(int) {}
+  void updateLength(size_t) {}
+  void setPin(int) {}
+  void begin() {}
+  void clear() {}
+  void show() {}
+  void setPixelColor(uint16_t, uint32_t) {}
+  bool canShow() { return true; }
+  uint8_t* getPixels() { return nullptr; }
+};
@@ -0,0 +1,20 @@
+#pragma once
+// just enough of the Arduino core for the host tests
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <string.h>
+typedef uint8_t byte;
+inline float degrees(float r) { return r * 57.29578f; }
+inline float radians(float d) { return d / 57.29578f; }
+struct Stream {
+  size_t write(uint8_t) { return 1; }
+  size_t write(const uint8_t*, size_t n) { return n; }
+  int read() { return -1; }
+  int available() { return 0; }
+  void flush() {}
+  void print(const char*) {}
+};
+struct HardwareSerial : Stream {};
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
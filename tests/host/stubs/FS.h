@@ -0,0 +1,7 @@
+#pragma once
+#include "Arduino.h"
+struct File : Stream {
+  operator bool() const { return true; }
+  void close() {}
+  size_t size() { return 0; }
+};
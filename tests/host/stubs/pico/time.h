@@ -0,0 +1,9 @@
+#pragma once
+// the free-running microsecond timer, which a host test
+// can set by hand
+#include <stdint.h>
+struct timer_hw_t {
+  volatile uint32_t timerawl;
+  volatile uint32_t timerawh;
+};
+extern timer_hw_t* timer_hw;
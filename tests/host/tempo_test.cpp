@@ -0,0 +1,118 @@
+/*
+ *  Checks the tempo engine on the host with made-up clock
+ *  timestamps: the master's tick timing and clock count,
+ *  and the slave locking to clock streams with jitter, to
+ *  a source far from the tempo setting, and through a jump
+ *  in tempo.
+ *
+ *  g++ -std=gnu++17 -O2 -Itests/host/stubs tests/host/tempo_test.cpp -o /tmp/tempo_test
+ *  /tmp/tempo_test
+ */
+#include <cstdio>
+#include <cstdlib>
+#include "../../src/tempo.h"
+
+int failures = 0;
+void check(bool ok, const char* what) {
+  if (!ok) {
+    std::printf("FAIL: %s\n", what);
+    ++failures;
+  }
+}
+
+// the same jitter every run
+uint32_t noise = 12345;
+int32_t jitter_uS(int32_t range) {
+  noise = noise * 1103515245u + 12345u;
+  return (int32_t)((noise >> 8) % (2 * range + 1)) - range;
+}
+
+// 3072 ticks at 128 BPM are 128 beats: exactly 60 s.
+// reading the due clocks now and then loses none.
+void master_test() {
+  Tempo_Engine tempo;
+  tempo.set_BPM(128);
+  tempo.reset(true, 0);
+  uint32_t now_uS = 0;
+  uint32_t taken  = 0;
+  for (int k = 0; k < 3072; ++k) {
+    now_uS += tempo.master_tick(now_uS);
+    if (k % 7 == 0) taken += tempo.take_clocks_due();
+  }
+  taken += tempo.take_clocks_due();
+  std::printf("master: 3072 ticks at 128 BPM in %u uS, %u clocks taken\n", now_uS, taken);
+  check(std::abs((int32_t)(now_uS - 60000000)) <= 1, "master: 128 beats in 60 s");
+  check(taken == 3072, "master: every clock taken once");
+}
+
+// clocks at BPM from a source with +/- jitter_range uS, to
+// a slave whose tempo setting is 120. returns the largest
+// phase error over the last beats, in beats.
+double worst_phase_error(Tempo_Engine& tempo, uint32_t& t0_uS, uint32_t BPM,
+                         int32_t jitter_range, int beats, int judged_beats) {
+  double   period_uS = 60e6 / (BPM * MIDI_clock_PPQN);
+  double   worst = 0.0;
+  uint32_t n = 0;
+  for (int k = 0; k < beats * (int)MIDI_clock_PPQN; ++k, ++n) {
+    uint32_t on_time_uS = t0_uS + (uint32_t)(n * period_uS);
+    tempo.on_clock(on_time_uS + jitter_uS(jitter_range));
+    if (k < (beats - judged_beats) * (int)MIDI_clock_PPQN) continue;
+    // where the beat really is, halfway to the next clock
+    uint32_t mid_uS = on_time_uS + (uint32_t)(period_uS / 2);
+    uint32_t truth  = clock_phase(tempo.clocks) + clock_phase(1) / 2;
+    double   error  = (int32_t)(tempo.phase(mid_uS) - truth) / (double)beat_phase_one;
+    if (error < 0) error = -error;
+    if (error > worst) worst = error;
+  }
+  t0_uS += (uint32_t)(n * period_uS);
+  return worst;
+}
+
+void slave_test() {
+  Tempo_Engine tempo;
+  tempo.set_BPM(120);
+  tempo.reset(false, 0);
+  tempo.on_start(0);
+  uint32_t t0_uS = 1000;
+  double error = worst_phase_error(tempo, t0_uS, 128, 1000, 32, 16);
+  std::printf("slave: 128 BPM +/-1 mS jitter: %u BPM, phase within %.4f beats\n", tempo.BPM(), error);
+  check((tempo.BPM() >= 127) && (tempo.BPM() <= 129), "slave: locks to 128 BPM through jitter");
+  check(error < 0.02, "slave: phase follows through jitter");
+}
+
+// the tempo setting is 120, the source is far outside the
+// window around it: the slave seeds from the clocks
+void fast_source_test() {
+  Tempo_Engine tempo;
+  tempo.set_BPM(120);
+  tempo.reset(false, 0);
+  tempo.on_start(0);
+  uint32_t t0_uS = 1000;
+  double error = worst_phase_error(tempo, t0_uS, 290, 0, 8, 4);
+  std::printf("slave: 290 BPM source: %u BPM, phase within %.4f beats\n", tempo.BPM(), error);
+  check(tempo.BPM() == 290, "fast source: locks to 290 BPM");
+  check(error < 0.01, "fast source: phase doesn't jump");
+}
+
+// the source jumps from 60 to 250 BPM mid-stream
+void tempo_jump_test() {
+  Tempo_Engine tempo;
+  tempo.set_BPM(120);
+  tempo.reset(false, 0);
+  tempo.on_start(0);
+  uint32_t t0_uS = 1000;
+  worst_phase_error(tempo, t0_uS, 60, 0, 4, 0);
+  double error = worst_phase_error(tempo, t0_uS, 250, 0, 8, 4);
+  std::printf("slave: 60 then 250 BPM: %u BPM, phase within %.4f beats\n", tempo.BPM(), error);
+  check(tempo.BPM() == 250, "tempo jump: locks to the new tempo");
+  check(error < 0.01, "tempo jump: phase follows");
+}
+
+int main() {
+  master_test();
+  slave_test();
+  fast_source_test();
+  tempo_jump_test();
+  std::printf("%s\n", failures ? "tempo test failed" : "tempo test passed");
+  return failures ? 1 : 0;
+}